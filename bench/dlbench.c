@@ -0,0 +1,364 @@
+/* m210 benchmarks
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+  Downloads a synthetic dump from the simulated device under
+  increasingly hostile conditions and reports the throughput and
+  how many packets had to be asked for again. Every scenario is run
+  with several seeds, a protocol which copes with one pattern of
+  faults can still fail on another, and every download is compared
+  against the dump. The counters are summed over the seeds.
+
+  Before measuring, a download cut off part way is resumed from its
+  journal, and then resumed again from the complete journal, each
+  time from a device which knows nothing of the earlier attempts.
+  Both must give the dump and leave the device ready for another
+  download, the run fails otherwise.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libm210/dev.h"
+#include "libm210/sim.h"
+
+#include "synth.h"
+
+struct dlbench_scenario {
+	char const *name;
+	size_t size;
+	struct m210_sim_params params;
+};
+
+/* The unpaced ones measure the protocol code alone, the paced one
+ * sends a packet per millisecond like the device on full-speed
+ * USB. Timeouts are real all the same: every loss which is noticed
+ * only by the device going quiet costs a full timeout. */
+static struct dlbench_scenario const SCENARIOS[] = {
+	{"clean",           1 << 20, {0, 0, 0.00, 0.00, 1}},
+	{"1% loss",         1 << 20, {0, 0, 0.01, 0.00, 1}},
+	{"5% loss+reorder", 1 << 20, {0, 0, 0.05, 0.05, 1}},
+	{"20% loss",        1 << 20, {0, 0, 0.20, 0.00, 1}},
+	{"usb paced",       1 << 16, {1000, 1000, 0.01, 0.00, 1}}
+};
+
+#define DLBENCH_SCENARIO_COUNT (sizeof(SCENARIOS) / sizeof(SCENARIOS[0]))
+
+/* Seeds 1 to this are run of every scenario, the seed of the
+ * scenario is ignored. */
+#define DLBENCH_SEED_COUNT 8
+
+/* The first download of the resume check is cut off after this
+ * many packets. */
+#define DLBENCH_RESUME_CUT 300
+
+struct dlbench_buffer {
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+};
+
+static enum m210_err dlbench_write(void *const arg, uint8_t const *const data,
+				   size_t const size)
+{
+	struct dlbench_buffer *const buffer = arg;
+
+	if (size > buffer->capacity - buffer->size) {
+		return M210_ERR_BAD_DEV_MSG;
+	}
+	memcpy(buffer->data + buffer->size, data, size);
+	buffer->size += size;
+	return M210_ERR_OK;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Downloads dump with the faults of scenario and the given seed,
+ * adds the time taken to *secs_ptr and the counters of the
+ * simulator to *totals_ptr. */
+static int run(struct dlbench_scenario const *const scenario,
+	       unsigned int const seed,
+	       uint8_t const *const dump, size_t const dump_size,
+	       struct dlbench_buffer *const buffer, double *const secs_ptr,
+	       struct m210_sim_counters *const totals_ptr)
+{
+	int result = -1;
+	m210_sim sim = NULL;
+	m210_dev dev = NULL;
+	struct m210_dev_transport transport;
+	struct m210_dev_sink const sink = {NULL, dlbench_write, buffer};
+	struct m210_sim_params params = scenario->params;
+	struct m210_sim_counters counters;
+	enum m210_err err;
+	double start;
+
+	params.seed = seed;
+	err = m210_sim_new(&sim, dump, dump_size, &params);
+	if (err) {
+		m210_err_perror(err, "dlbench: failed to simulate device");
+		goto out;
+	}
+	m210_sim_get_transport(sim, &transport);
+
+	err = m210_dev_connect_transport(&dev, &transport);
+	if (err) {
+		m210_err_perror(err, "dlbench: failed to connect");
+		goto out;
+	}
+
+	buffer->size = 0;
+	start = now();
+	err = m210_dev_download_notes_to_sink(dev, &sink);
+	*secs_ptr += now() - start;
+	if (err) {
+		char msg[128];
+
+		snprintf(msg, sizeof(msg), "dlbench: %s: seed %u: download "
+			 "failed", scenario->name, seed);
+		m210_err_perror(err, msg);
+		goto out;
+	}
+
+	if (buffer->size != dump_size
+	    || memcmp(buffer->data, dump, dump_size)) {
+		fprintf(stderr, "dlbench: %s: seed %u: downloaded dump "
+			"differs\n", scenario->name, seed);
+		goto out;
+	}
+
+	m210_sim_get_counters(sim, &counters);
+	totals_ptr->packets += counters.packets;
+	totals_ptr->lost += counters.lost;
+	totals_ptr->reordered += counters.reordered;
+	totals_ptr->resends += counters.resends;
+
+	result = 0;
+out:
+	m210_dev_disconnect(&dev);
+	m210_sim_free(&sim);
+	return result;
+}
+
+/* Resumes dump_size bytes of dump from journal on a new simulated
+ * device into buffer, and downloads it once more without a journal
+ * to see that the device was left idle. Sets *packets_ptr to the
+ * packets the resume took from the device. */
+static int resume(uint8_t const *const dump, size_t const dump_size,
+		  FILE *const journal, struct dlbench_buffer *const buffer,
+		  uint64_t *const packets_ptr)
+{
+	int result = -1;
+	struct m210_sim_params const params = {0, 0, 0, 0, 1};
+	m210_sim sim = NULL;
+	m210_dev dev = NULL;
+	struct m210_dev_transport transport;
+	struct m210_dev_sink const sink = {NULL, dlbench_write, buffer};
+	struct m210_sim_counters counters;
+	enum m210_err err;
+
+	err = m210_sim_new(&sim, dump, dump_size, &params);
+	if (err) {
+		m210_err_perror(err, "dlbench: failed to simulate device");
+		goto out;
+	}
+	m210_sim_get_transport(sim, &transport);
+
+	err = m210_dev_connect_transport(&dev, &transport);
+	if (err) {
+		m210_err_perror(err, "dlbench: failed to connect");
+		goto out;
+	}
+
+	buffer->size = 0;
+	err = m210_dev_resume_notes_to_sink(dev, &sink, journal);
+	if (err) {
+		m210_err_perror(err, "dlbench: resume failed");
+		goto out;
+	}
+	if (buffer->size != dump_size
+	    || memcmp(buffer->data, dump, dump_size)) {
+		fprintf(stderr, "dlbench: resumed dump differs\n");
+		goto out;
+	}
+	m210_sim_get_counters(sim, &counters);
+	*packets_ptr = counters.packets;
+
+	buffer->size = 0;
+	err = m210_dev_download_notes_to_sink(dev, &sink);
+	if (err) {
+		m210_err_perror(err, "dlbench: download after resume failed");
+		goto out;
+	}
+	if (buffer->size != dump_size
+	    || memcmp(buffer->data, dump, dump_size)) {
+		fprintf(stderr, "dlbench: dump downloaded after resume "
+			"differs\n");
+		goto out;
+	}
+
+	result = 0;
+out:
+	m210_dev_disconnect(&dev);
+	m210_sim_free(&sim);
+	return result;
+}
+
+static int check_resume(uint8_t const *const dump, size_t const dump_size,
+			struct dlbench_buffer *const buffer)
+{
+	int result = -1;
+	struct m210_sim_params const params = {0, 0, 0, 0, 1};
+	m210_sim sim = NULL;
+	m210_dev dev = NULL;
+	struct m210_dev_transport transport;
+	struct m210_dev_sink const sink = {NULL, dlbench_write, buffer};
+	size_t const capacity = buffer->capacity;
+	FILE *journal = NULL;
+	uint64_t packets;
+	enum m210_err err;
+
+	journal = tmpfile();
+	if (journal == NULL) {
+		perror("dlbench: failed to create journal");
+		goto out;
+	}
+
+	err = m210_sim_new(&sim, dump, dump_size, &params);
+	if (err) {
+		m210_err_perror(err, "dlbench: failed to simulate device");
+		goto out;
+	}
+	m210_sim_get_transport(sim, &transport);
+
+	err = m210_dev_connect_transport(&dev, &transport);
+	if (err) {
+		m210_err_perror(err, "dlbench: failed to connect");
+		goto out;
+	}
+
+	/* The full buffer fails the download like an interruption. */
+	buffer->size = 0;
+	buffer->capacity = DLBENCH_RESUME_CUT * M210_DEV_PACKET_SIZE;
+	err = m210_dev_resume_notes_to_sink(dev, &sink, journal);
+	buffer->capacity = capacity;
+	if (!err) {
+		fprintf(stderr, "dlbench: cut-off download did not fail\n");
+		goto out;
+	}
+
+	if (resume(dump, dump_size, journal, buffer, &packets)) {
+		goto out;
+	}
+
+	if (resume(dump, dump_size, journal, buffer, &packets)) {
+		goto out;
+	}
+	if (packets) {
+		fprintf(stderr, "dlbench: resume from a complete journal "
+			"took %llu packets\n", (unsigned long long) packets);
+		goto out;
+	}
+
+	printf("dlbench: resume from a partial and a complete journal ok\n");
+	result = 0;
+out:
+	m210_dev_disconnect(&dev);
+	m210_sim_free(&sim);
+	if (journal) {
+		fclose(journal);
+	}
+	return result;
+}
+
+int main(void)
+{
+	int exitval = EXIT_FAILURE;
+	struct dlbench_buffer buffer;
+	uint8_t *dump = NULL;
+
+	memset(&buffer, 0, sizeof(buffer));
+
+	dump = malloc(M210_DEV_MAX_MEMORY);
+	buffer.data = malloc(M210_DEV_MAX_MEMORY);
+	buffer.capacity = M210_DEV_MAX_MEMORY;
+	if (dump == NULL || buffer.data == NULL) {
+		perror("dlbench: malloc");
+		goto out;
+	}
+
+	{
+		struct synth_params const params = {1 << 16, 16, 120, 12, 1};
+		size_t const dump_size = synth_dump(dump, M210_DEV_MAX_MEMORY,
+						    &params);
+
+		if (dump_size == 0) {
+			fprintf(stderr, "dlbench: failed to build the dump\n");
+			goto out;
+		}
+		if (check_resume(dump, dump_size, &buffer)) {
+			goto out;
+		}
+	}
+
+	printf("dlbench: downloads from the simulated device, %d seeds "
+	       "each\n", DLBENCH_SEED_COUNT);
+	printf("  %-16s %8s %9s %9s %7s %6s %6s %7s\n",
+	       "scenario", "bytes", "secs", "KiB/s", "packets", "lost",
+	       "reord", "resends");
+
+	for (size_t i = 0; i < DLBENCH_SCENARIO_COUNT; ++i) {
+		struct synth_params const params = {SCENARIOS[i].size, 16, 120, 12, 1};
+		size_t const dump_size = synth_dump(dump, M210_DEV_MAX_MEMORY,
+						    &params);
+
+		if (dump_size == 0) {
+			fprintf(stderr, "dlbench: failed to build the dump\n");
+			goto out;
+		}
+		struct m210_sim_counters totals;
+		double secs = 0;
+
+		memset(&totals, 0, sizeof(totals));
+		for (unsigned int seed = 1; seed <= DLBENCH_SEED_COUNT; ++seed) {
+			if (run(&SCENARIOS[i], seed, dump, dump_size, &buffer,
+				&secs, &totals)) {
+				goto out;
+			}
+		}
+
+		printf("  %-16s %8zu %9.3f %9.0f %7llu %6llu %6llu %7llu\n",
+		       SCENARIOS[i].name, dump_size, secs,
+		       DLBENCH_SEED_COUNT * dump_size / 1024.0 / secs,
+		       (unsigned long long) totals.packets,
+		       (unsigned long long) totals.lost,
+		       (unsigned long long) totals.reordered,
+		       (unsigned long long) totals.resends);
+	}
+
+	exitval = EXIT_SUCCESS;
+out:
+	free(buffer.data);
+	free(dump);
+	return exitval;
+}
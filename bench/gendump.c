@@ -0,0 +1,172 @@
+/* m210 benchmarks
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+  Writes a synthetic raw dump, from a single note up to a full
+  device memory, in the format m210 dump downloads. The same
+  parameters always give the same dump.
+*/
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libm210/dev.h"
+
+#include "synth.h"
+
+static void print_help(void)
+{
+	printf("Usage: gendump [--size=BYTES] [--notes=N] [--stroke-length=N]\n"
+	       "               [--step=N] [--seed=N] [--output-file=FILE]\n"
+	       "\n"
+	       "Options:\n"
+	       "    --size=BYTES        size of the dump, defaults to the\n"
+	       "                        whole device memory, %d\n"
+	       "    --notes=N           number of notes sharing the size,\n"
+	       "                        defaults to 16\n"
+	       "    --stroke-length=N   mean number of pen-down samples\n"
+	       "                        between pen-ups, defaults to 120\n"
+	       "    --step=N            largest move between samples in\n"
+	       "                        device units, defaults to 12\n"
+	       "    --seed=N            defaults to 1\n"
+	       "    --output-file=FILE  defaults to standard output\n",
+	       M210_DEV_MAX_MEMORY);
+}
+
+static int parse_ulong(char const *str, unsigned long max,
+		       unsigned long *value_ptr)
+{
+	char *end;
+	unsigned long value;
+
+	errno = 0;
+	value = strtoul(str, &end, 10);
+	if (errno || end == str || *end != '\0' || *str == '-'
+	    || value > max) {
+		return -1;
+	}
+	*value_ptr = value;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int exitval = EXIT_FAILURE;
+	struct synth_params params = {M210_DEV_MAX_MEMORY, 16, 120, 12, 1};
+	char const *output_path = NULL;
+	FILE *output_file = stdout;
+	uint8_t *dump = NULL;
+	size_t dump_size;
+	const struct option opts[] = {
+		{"help", no_argument, NULL, 'h'},
+		{"size", required_argument, NULL, 'z'},
+		{"notes", required_argument, NULL, 'n'},
+		{"stroke-length", required_argument, NULL, 'l'},
+		{"step", required_argument, NULL, 't'},
+		{"seed", required_argument, NULL, 's'},
+		{"output-file", required_argument, NULL, 'o'},
+		{0, 0, 0, 0}
+	};
+
+	while (1) {
+		unsigned long value;
+		int option = getopt_long(argc, argv, "", opts, NULL);
+
+		if (option == -1) {
+			break;
+		}
+
+		switch (option) {
+		case 'h':
+			print_help();
+			exitval = EXIT_SUCCESS;
+			goto out;
+		case 'o':
+			output_path = optarg;
+			continue;
+		case '?':
+			goto out;
+		}
+
+		if (parse_ulong(optarg, option == 'z'
+				? M210_DEV_MAX_MEMORY : 0xffffffff, &value)) {
+			fprintf(stderr, "gendump: invalid value '%s'\n",
+				optarg);
+			goto out;
+		}
+
+		switch (option) {
+		case 'z':
+			params.size = value;
+			break;
+		case 'n':
+			params.note_count = value;
+			break;
+		case 'l':
+			params.stroke_length = value;
+			break;
+		case 't':
+			params.step = value;
+			break;
+		case 's':
+			params.seed = value;
+			break;
+		}
+	}
+
+	if (optind != argc) {
+		fprintf(stderr, "gendump: unexpected arguments\n");
+		goto out;
+	}
+
+	dump = malloc(M210_DEV_MAX_MEMORY);
+	if (dump == NULL) {
+		perror("gendump: malloc");
+		goto out;
+	}
+
+	dump_size = synth_dump(dump, M210_DEV_MAX_MEMORY, &params);
+	if (dump_size == 0) {
+		fprintf(stderr, "gendump: parameters give no dump, the size "
+			"must fit every note and at least one packet\n");
+		goto out;
+	}
+
+	if (output_path) {
+		output_file = fopen(output_path, "wb");
+		if (output_file == NULL) {
+			perror("gendump: failed to open output file");
+			goto out;
+		}
+	}
+
+	if (fwrite(dump, dump_size, 1, output_file) != 1) {
+		perror("gendump: failed to write dump");
+		goto out;
+	}
+
+	exitval = EXIT_SUCCESS;
+out:
+	if (output_file && output_file != stdout && fclose(output_file)) {
+		perror("gendump: failed to close output file");
+		exitval = EXIT_FAILURE;
+	}
+	free(dump);
+	return exitval;
+}
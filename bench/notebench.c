@@ -0,0 +1,353 @@
+/* m210 benchmarks
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+  Measures the paths from a raw dump to notes over a full-memory
+  synthetic dump kept in memory: the stdio reader body by body, the
+  mapped reader with the bulk decoder, and both of them feeding SVG
+  writers like convert does. Throughput is given in points and raw
+  megabytes per second. SVG output goes to /dev/null.
+
+  Each path is an entry of PATHS, a new one is measured by adding
+  it there.
+
+  Before measuring, every decoding kernel the CPU has is checked to
+  give exactly what the scalar one gives, the run fails otherwise.
+*/
+
+#include <endian.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libm210/dev.h"
+#include "libm210/note.h"
+#include "libm210/rawnote.h"
+#include "libm210/svg.h"
+
+#include "synth.h"
+
+#define NOTEBENCH_NOTE_COUNT 64
+#define NOTEBENCH_STROKE_LENGTH 120
+#define NOTEBENCH_STEP 12
+/* Bodies decoded by every kernel, odd so that the scalar tail of
+ * the vector kernels runs too. */
+#define NOTEBENCH_CHECK_COUNT 4099
+
+struct notebench_ctx {
+	uint8_t *dump;
+	size_t dump_size;
+	FILE *null_file;
+	m210_svg svg;
+	int16_t *xs;
+	int16_t *ys;
+	uint16_t *pressures;
+	size_t point_count; /* Points walked by the last run. */
+};
+
+struct notebench_path {
+	char const *name;
+	enum m210_svg_style style;
+	int (*run)(struct notebench_ctx *ctx, int write_svg);
+	int write_svg;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_note(struct notebench_ctx *ctx, size_t count)
+{
+	if (m210_svg_begin(ctx->svg, ctx->null_file)
+	    || m210_svg_write_bodies(ctx->svg, ctx->xs, ctx->ys,
+				     ctx->pressures, count)
+	    || m210_svg_end(ctx->svg)) {
+		return -1;
+	}
+	return 0;
+}
+
+/* m210_note_read_head() and m210_note_read_body() one body at a
+ * time, the stdio reader. */
+static int run_stdio(struct notebench_ctx *ctx, int write_svg)
+{
+	int result = -1;
+	FILE *file;
+
+	file = fmemopen(ctx->dump, ctx->dump_size, "rb");
+	if (file == NULL) {
+		perror("notebench: fmemopen");
+		return -1;
+	}
+
+	ctx->point_count = 0;
+	while (1) {
+		struct m210_note_head head;
+		enum m210_err err;
+
+		err = m210_note_read_head(&head, file);
+		if (err) {
+			m210_err_perror(err, "notebench: failed to read head");
+			goto out;
+		}
+		if (head.number == 0) {
+			break;
+		}
+
+		for (ssize_t i = 0; i < head.bodyc; ++i) {
+			struct m210_note_body body;
+
+			err = m210_note_read_body(&body, file);
+			if (err) {
+				m210_err_perror(err,
+						"notebench: failed to read body");
+				goto out;
+			}
+			ctx->xs[i] = body.x;
+			ctx->ys[i] = body.y;
+			ctx->pressures[i] = body.pressure;
+		}
+		ctx->point_count += head.bodyc;
+
+		if (write_svg && write_note(ctx, head.bodyc)) {
+			perror("notebench: failed to write SVG");
+			goto out;
+		}
+	}
+
+	result = 0;
+out:
+	fclose(file);
+	return result;
+}
+
+/* m210_note_map_read() and m210_note_decode_bodies() a note at a
+ * time, the way convert reads its input. */
+static int run_map(struct notebench_ctx *ctx, int write_svg)
+{
+	int result = -1;
+	m210_note_map map = NULL;
+	enum m210_err err;
+
+	err = m210_note_map_open_buffer(&map, ctx->dump, ctx->dump_size);
+	if (err) {
+		m210_err_perror(err, "notebench: failed to open map");
+		return -1;
+	}
+
+	ctx->point_count = 0;
+	while (1) {
+		struct m210_note_span span;
+
+		err = m210_note_map_read(map, &span);
+		if (err) {
+			m210_err_perror(err, "notebench: failed to read note");
+			goto out;
+		}
+		if (span.number == 0) {
+			break;
+		}
+
+		m210_note_decode_bodies(ctx->xs, ctx->ys, ctx->pressures,
+					span.rawbodies, span.bodyc);
+		ctx->point_count += span.bodyc;
+
+		if (write_svg && write_note(ctx, span.bodyc)) {
+			perror("notebench: failed to write SVG");
+			goto out;
+		}
+	}
+
+	result = 0;
+out:
+	m210_note_map_close(&map);
+	return result;
+}
+
+static struct {
+	char const *name;
+	enum m210_note_decoder decoder;
+} const DECODERS[] = {
+	{"sse2", M210_NOTE_DECODER_SSE2},
+	{"avx2", M210_NOTE_DECODER_AVX2}
+};
+
+#define NOTEBENCH_DECODER_COUNT (sizeof(DECODERS) / sizeof(DECODERS[0]))
+
+/* Decodes the same bodies, random words with pen-ups and extreme
+ * coordinates mixed in, through every available kernel and every
+ * count up to a few vectors plus NOTEBENCH_CHECK_COUNT, and compares
+ * the results to the scalar kernel. */
+static int check_decoders(void)
+{
+	int result = -1;
+	size_t const n = NOTEBENCH_CHECK_COUNT;
+	uint32_t *words = malloc(n * sizeof(uint32_t));
+	int16_t *xs[2] = {malloc(n * sizeof(int16_t)), malloc(n * sizeof(int16_t))};
+	int16_t *ys[2] = {malloc(n * sizeof(int16_t)), malloc(n * sizeof(int16_t))};
+	uint16_t *ps[2] = {malloc(n * sizeof(uint16_t)),
+			   malloc(n * sizeof(uint16_t))};
+	uint32_t const specials[] = {0x80000000, 0x00000000, 0xffffffff,
+				     0x7fff7fff, 0x80008000, 0x00008000,
+				     0x7fff8000, 0x80007fff};
+	uint32_t state = 2463534242u;
+
+	if (!words || !xs[0] || !xs[1] || !ys[0] || !ys[1] || !ps[0]
+	    || !ps[1]) {
+		perror("notebench: malloc");
+		goto out;
+	}
+
+	for (size_t i = 0; i < n; ++i) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		words[i] = state % 4 ? state : specials[(state >> 8) % 8];
+		words[i] = htole32(words[i]);
+	}
+
+	for (size_t k = 0; k < NOTEBENCH_DECODER_COUNT; ++k) {
+		for (size_t count = 0; count <= n;
+		     count = count < 67 ? count + 1 : n) {
+			struct m210_rawnote_body const *const bodies =
+				(struct m210_rawnote_body const *) words;
+
+			m210_note_decode_bodies_with(M210_NOTE_DECODER_SCALAR,
+						     xs[0], ys[0], ps[0],
+						     bodies, count);
+			if (m210_note_decode_bodies_with(DECODERS[k].decoder,
+							 xs[1], ys[1], ps[1],
+							 bodies, count)) {
+				printf("notebench: %s decoder not available\n",
+				       DECODERS[k].name);
+				break;
+			}
+			if (memcmp(xs[0], xs[1], count * sizeof(int16_t))
+			    || memcmp(ys[0], ys[1], count * sizeof(int16_t))
+			    || memcmp(ps[0], ps[1], count * sizeof(uint16_t))) {
+				fprintf(stderr, "notebench: %s decoder differs "
+					"from scalar at %zu bodies\n",
+					DECODERS[k].name, count);
+				goto out;
+			}
+			if (count == n) {
+				printf("notebench: %s decoder matches scalar\n",
+				       DECODERS[k].name);
+				break;
+			}
+		}
+	}
+
+	result = 0;
+out:
+	for (int i = 0; i < 2; ++i) {
+		free(ps[i]);
+		free(ys[i]);
+		free(xs[i]);
+	}
+	free(words);
+	return result;
+}
+
+static struct notebench_path const PATHS[] = {
+	{"read_body",        M210_SVG_STYLE_POLYLINE, run_stdio, 0},
+	{"map+decode",       M210_SVG_STYLE_POLYLINE, run_map,   0},
+	{"read_body+svg",    M210_SVG_STYLE_POLYLINE, run_stdio, 1},
+	{"map+svg",          M210_SVG_STYLE_POLYLINE, run_map,   1},
+	{"map+svg compact",  M210_SVG_STYLE_PATH,     run_map,   1}
+};
+
+#define NOTEBENCH_PATH_COUNT (sizeof(PATHS) / sizeof(PATHS[0]))
+
+int main(int argc, char **argv)
+{
+	int exitval = EXIT_FAILURE;
+	struct synth_params const params = {
+		M210_DEV_MAX_MEMORY,
+		NOTEBENCH_NOTE_COUNT,
+		NOTEBENCH_STROKE_LENGTH,
+		NOTEBENCH_STEP,
+		1
+	};
+	struct notebench_ctx ctx;
+	size_t const max_bodies = M210_DEV_MAX_MEMORY
+		/ sizeof(struct m210_rawnote_body);
+	int rounds = argc > 1 ? atoi(argv[1]) : 5;
+
+	memset(&ctx, 0, sizeof(ctx));
+
+	if (check_decoders()) {
+		goto out;
+	}
+
+	ctx.dump = malloc(M210_DEV_MAX_MEMORY);
+	ctx.xs = malloc(max_bodies * sizeof(int16_t));
+	ctx.ys = malloc(max_bodies * sizeof(int16_t));
+	ctx.pressures = malloc(max_bodies * sizeof(uint16_t));
+	if (!ctx.dump || !ctx.xs || !ctx.ys || !ctx.pressures) {
+		perror("notebench: malloc");
+		goto out;
+	}
+
+	ctx.dump_size = synth_dump(ctx.dump, M210_DEV_MAX_MEMORY, &params);
+	if (ctx.dump_size == 0) {
+		fprintf(stderr, "notebench: failed to build the dump\n");
+		goto out;
+	}
+
+	ctx.null_file = fopen("/dev/null", "w");
+	if (ctx.null_file == NULL || m210_svg_new(&ctx.svg)) {
+		perror("notebench");
+		goto out;
+	}
+
+	printf("notebench: %zu byte dump, %d rounds\n", ctx.dump_size, rounds);
+	printf("  %-16s %10s %12s %8s\n", "path", "points", "points/s", "MB/s");
+
+	for (size_t i = 0; i < NOTEBENCH_PATH_COUNT; ++i) {
+		double secs = 0;
+
+		m210_svg_set_style(ctx.svg, PATHS[i].style);
+		for (int round = 0; round < rounds; ++round) {
+			double const start = now();
+
+			if (PATHS[i].run(&ctx, PATHS[i].write_svg)) {
+				goto out;
+			}
+			secs += now() - start;
+		}
+		printf("  %-16s %10zu %12.0f %8.1f\n", PATHS[i].name,
+		       ctx.point_count, ctx.point_count * rounds / secs,
+		       ctx.dump_size * rounds / secs / 1e6);
+	}
+
+	exitval = EXIT_SUCCESS;
+out:
+	m210_svg_free(&ctx.svg);
+	if (ctx.null_file) {
+		fclose(ctx.null_file);
+	}
+	free(ctx.pressures);
+	free(ctx.ys);
+	free(ctx.xs);
+	free(ctx.dump);
+	return exitval;
+}
@@ -0,0 +1,209 @@
+/* m210 benchmarks
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+  Measures how fast decoded bodies of a full-memory synthetic dump
+  are turned to SVG markup: the old per-point fprintf() emitter
+  against the buffered m210_svg writer. Output goes to /dev/null.
+*/
+
+#include <endian.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libm210/dev.h"
+#include "libm210/note.h"
+#include "libm210/rawnote.h"
+#include "libm210/svg.h"
+
+#include "synth.h"
+
+#define SVGBENCH_NOTE_COUNT 64
+#define SVGBENCH_STROKE_LENGTH 120
+#define SVGBENCH_STEP 12
+
+struct decoded_note {
+	size_t count;
+	int16_t *xs;
+	int16_t *ys;
+	uint16_t *pressures;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The emitter convert used before m210_svg, kept here as the
+ * baseline. */
+static void fprintf_note(FILE *file, struct decoded_note const *note)
+{
+	int has_path = 0;
+
+	fprintf(file, "%s\n", "<?xml version=\"1.0\"?>");
+	fprintf(file, "%s\n", "<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" \"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">");
+	fprintf(file, "%s\n", "<svg width=\"210mm\" height=\"297mm\" viewBox=\"-7000 0 14000 20000\" xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\">");
+	for (size_t i = 0; i < note->count; ++i) {
+		if (note->pressures[i]) {
+			if (!has_path) {
+				fprintf(file,
+					"<polyline stroke-width=\"%d\" "
+					"stroke=\"%s\" fill=\"none\" points=\"",
+					20, "black");
+				has_path = 1;
+			}
+			fprintf(file, "%d,%d ", note->xs[i], note->ys[i]);
+		} else {
+			fprintf(file, "%s\n", "\" />");
+			has_path = 0;
+		}
+	}
+	fprintf(file, "%s", "</svg>\n");
+}
+
+static int svg_note(FILE *file, m210_svg svg, struct decoded_note const *note)
+{
+	if (m210_svg_begin(svg, file)
+	    || m210_svg_write_bodies(svg, note->xs, note->ys,
+				     note->pressures, note->count)
+	    || m210_svg_end(svg)) {
+		return -1;
+	}
+	return 0;
+}
+
+static int decode_dump(uint8_t const *dump, size_t size,
+		       struct decoded_note *notes, size_t *point_count_ptr)
+{
+	size_t pos = 0;
+	size_t point_count = 0;
+
+	for (int i = 0; i < SVGBENCH_NOTE_COUNT; ++i) {
+		struct m210_rawnote_head head;
+		uint32_t next_pos = 0;
+		size_t count;
+
+		if (size - pos < sizeof(head)) {
+			return -1;
+		}
+		memcpy(&head, dump + pos, sizeof(head));
+		memcpy(&next_pos, head.next_pos, 3);
+		next_pos = le32toh(next_pos);
+		pos += sizeof(head);
+		count = (next_pos - pos) / sizeof(struct m210_rawnote_body);
+
+		notes[i].count = count;
+		notes[i].xs = malloc(count * sizeof(int16_t));
+		notes[i].ys = malloc(count * sizeof(int16_t));
+		notes[i].pressures = malloc(count * sizeof(uint16_t));
+		if (!notes[i].xs || !notes[i].ys || !notes[i].pressures) {
+			return -1;
+		}
+		m210_note_decode_bodies(
+			notes[i].xs, notes[i].ys, notes[i].pressures,
+			(struct m210_rawnote_body const *) (dump + pos), count);
+		point_count += count;
+		pos = next_pos;
+	}
+	*point_count_ptr = point_count;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int exitval = EXIT_FAILURE;
+	struct synth_params const params = {
+		M210_DEV_MAX_MEMORY,
+		SVGBENCH_NOTE_COUNT,
+		SVGBENCH_STROKE_LENGTH,
+		SVGBENCH_STEP,
+		1
+	};
+	struct decoded_note notes[SVGBENCH_NOTE_COUNT];
+	uint8_t *dump = NULL;
+	size_t dump_size;
+	size_t point_count;
+	int rounds = argc > 1 ? atoi(argv[1]) : 5;
+	FILE *null_file = NULL;
+	m210_svg svg = NULL;
+	double fprintf_secs = 0;
+	double svg_secs = 0;
+
+	memset(notes, 0, sizeof(notes));
+
+	dump = malloc(M210_DEV_MAX_MEMORY);
+	if (dump == NULL) {
+		perror("svgbench: malloc");
+		goto out;
+	}
+
+	dump_size = synth_dump(dump, M210_DEV_MAX_MEMORY, &params);
+	if (dump_size == 0
+	    || decode_dump(dump, dump_size, notes, &point_count)) {
+		fprintf(stderr, "svgbench: failed to build the dump\n");
+		goto out;
+	}
+
+	null_file = fopen("/dev/null", "w");
+	if (null_file == NULL || m210_svg_new(&svg)) {
+		perror("svgbench");
+		goto out;
+	}
+
+	for (int round = 0; round < rounds; ++round) {
+		double start = now();
+		for (int i = 0; i < SVGBENCH_NOTE_COUNT; ++i) {
+			fprintf_note(null_file, notes + i);
+		}
+		fflush(null_file);
+		fprintf_secs += now() - start;
+
+		start = now();
+		for (int i = 0; i < SVGBENCH_NOTE_COUNT; ++i) {
+			if (svg_note(null_file, svg, notes + i)) {
+				perror("svgbench");
+				goto out;
+			}
+		}
+		svg_secs += now() - start;
+	}
+
+	printf("svgbench: %zu byte dump, %zu points, %d rounds\n",
+	       dump_size, point_count, rounds);
+	printf("  fprintf   %12.0f points/s\n",
+	       point_count * rounds / fprintf_secs);
+	printf("  m210_svg  %12.0f points/s\n",
+	       point_count * rounds / svg_secs);
+
+	exitval = EXIT_SUCCESS;
+out:
+	for (int i = 0; i < SVGBENCH_NOTE_COUNT; ++i) {
+		free(notes[i].xs);
+		free(notes[i].ys);
+		free(notes[i].pressures);
+	}
+	m210_svg_free(&svg);
+	if (null_file) {
+		fclose(null_file);
+	}
+	free(dump);
+	return exitval;
+}
@@ -0,0 +1,135 @@
+/* m210 benchmarks
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <endian.h>
+#include <string.h>
+
+#include "libm210/dev.h"
+#include "libm210/rawnote.h"
+
+#include "synth.h"
+
+/* Device units, roughly the area of an A4 paper. */
+#define SYNTH_MIN_X -6500
+#define SYNTH_MAX_X 6500
+#define SYNTH_MIN_Y 500
+#define SYNTH_MAX_Y 19500
+
+static unsigned int synth_rand(unsigned int *const state)
+{
+	/* Plain LCG: the dumps only need to look like handwriting,
+	 * and they must be the same on every run. */
+	*state = *state * 1103515245 + 12345;
+	return (*state >> 16) & 0x7fff;
+}
+
+static int synth_between(unsigned int *const state, int const min,
+			 int const max)
+{
+	return min + (int) (synth_rand(state) % (unsigned int) (max - min + 1));
+}
+
+/* Keeps long strokes with large steps on the paper. */
+static int synth_clamp(int const value, int const min, int const max)
+{
+	return value < min ? min : value > max ? max : value;
+}
+
+static void synth_put_body(uint8_t *const p, int const x, int const y)
+{
+	uint16_t const lex = htole16((uint16_t) x);
+	uint16_t const ley = htole16((uint16_t) y);
+
+	memcpy(p, &lex, 2);
+	memcpy(p + 2, &ley, 2);
+}
+
+size_t synth_dump(uint8_t *const buf, size_t const buf_size,
+		  struct synth_params const *const params)
+{
+	size_t const head_size = sizeof(struct m210_rawnote_head);
+	size_t const body_size = sizeof(struct m210_rawnote_body);
+	unsigned int state = params->seed;
+	int const step = params->step;
+	size_t bodies_per_note;
+	size_t pos = 0;
+	size_t size;
+
+	if (params->note_count == 0 || params->stroke_length == 0
+	    || params->step > SYNTH_MAX_X - SYNTH_MIN_X
+	    || params->size > M210_DEV_MAX_MEMORY
+	    || params->size < (params->note_count + 1) * head_size
+	    + M210_DEV_PACKET_SIZE) {
+		return 0;
+	}
+
+	/* Leave room for the empty head and one packet of padding. */
+	bodies_per_note = ((params->size - M210_DEV_PACKET_SIZE
+			    - (params->note_count + 1) * head_size)
+			   / params->note_count / body_size);
+	size = ((params->note_count + 1) * head_size
+		+ params->note_count * bodies_per_note * body_size);
+	size += (M210_DEV_PACKET_SIZE - size % M210_DEV_PACKET_SIZE)
+		% M210_DEV_PACKET_SIZE;
+	if (size > buf_size || bodies_per_note == 0) {
+		return 0;
+	}
+
+	memset(buf, 0, size);
+
+	for (unsigned int notei = 0; notei < params->note_count; ++notei) {
+		struct m210_rawnote_head head;
+		uint32_t const next_pos = htole32(pos + head_size
+						   + bodies_per_note
+						   * body_size);
+		size_t bodyi = 0;
+
+		memset(&head, 0, sizeof(head));
+		memcpy(head.next_pos, &next_pos, 3);
+		head.state = M210_RAWNOTE_STATE_FINISHED_BY_USER;
+		head.number = notei % 255 + 1;
+		head.last_number = params->note_count % 255;
+		memcpy(buf + pos, &head, head_size);
+		pos += head_size;
+
+		while (bodyi < bodies_per_note) {
+			int const len = synth_between(
+				&state, (params->stroke_length + 1) / 2,
+				params->stroke_length * 3 / 2 + 1);
+			int x = synth_between(&state, SYNTH_MIN_X, SYNTH_MAX_X);
+			int y = synth_between(&state, SYNTH_MIN_Y, SYNTH_MAX_Y);
+
+			/* Pen-down samples, then a pen-up, the last
+			 * body of a note is always a pen-up. */
+			for (int i = 0; i < len && bodyi + 1 < bodies_per_note;
+			     ++i, ++bodyi) {
+				x += synth_between(&state, -step, step);
+				y += synth_between(&state, -step, step);
+				x = synth_clamp(x, SYNTH_MIN_X, SYNTH_MAX_X);
+				y = synth_clamp(y, SYNTH_MIN_Y, SYNTH_MAX_Y);
+				synth_put_body(buf + pos, x, y);
+				pos += body_size;
+			}
+			memcpy(buf + pos, &M210_RAWNOTE_BODY_PENUP, body_size);
+			pos += body_size;
+			++bodyi;
+		}
+	}
+
+	/* The empty head and padding are zeros already. */
+	return size;
+}
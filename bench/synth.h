@@ -0,0 +1,42 @@
+/* m210 benchmarks
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct synth_params {
+	size_t size;                /* Bytes, at most M210_DEV_MAX_MEMORY. */
+	unsigned int note_count;
+	unsigned int stroke_length; /* Mean number of samples per stroke,
+				     * one pen-up follows each stroke. */
+	unsigned int step;          /* Largest move between samples, in
+				     * device units. */
+	unsigned int seed;
+};
+
+/* Fills buf with a raw dump of params->note_count notes that share
+ * params->size bytes evenly. The dump ends like a downloaded one:
+ * with an empty head and zero-padding up to the packet
+ * boundary. Returns the size of the dump, or 0 if it does not fit
+ * to buf_size bytes. */
+size_t synth_dump(uint8_t *buf, size_t buf_size,
+		  struct synth_params const *params);
+
+#endif /* SYNTH_H */
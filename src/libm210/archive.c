@@ -0,0 +1,666 @@
+/* libm210
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <endian.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "archive.h"
+#include "dev.h"
+#include "rawnote.h"
+
+/*
+  Archive file:
+
+  * 8 bytes: M210_ARCHIVE_MAGIC
+  * records until the end of the file, a note record for each note
+    and an end record at the end of each dump
+
+  Archives appended to each other hold the dumps of all of them, like
+  raw dumps appended to each other do: the magic may also stand
+  between dumps.
+
+  Note record:
+
+  * 1 byte: M210_ARCHIVE_NOTE
+  * 1 byte each: state, number and last number of the raw head
+  * 1 byte: flags, M210_ARCHIVE_RESERVED and M210_ARCHIVE_TAIL
+  * 8 bytes: reserved bytes of the raw head, if M210_ARCHIVE_RESERVED
+    is set, otherwise they are zeros
+  * strokes
+  * varint and bytes: length and bytes of the tail, if
+    M210_ARCHIVE_TAIL is set: what is left of the data section of
+    the note after the last whole body
+
+  Stroke:
+
+  * varint: point count times two, plus one if a pen-up follows
+  * varints: x and y of each point
+
+  Strokes follow each other until one is not followed by a pen-up.
+  A note which ends with a pen-up ends with an empty stroke. The
+  coordinates are zigzag-coded 16-bit differences from the previous
+  point of the note, the first from 0,0: a move of -64..63 units
+  takes a byte.
+
+  End record:
+
+  * 1 byte: M210_ARCHIVE_END
+  * varint: size of the padding after the empty raw head
+  * 1 byte: 0 if the padding is zeros, 1 if its bytes follow
+  * bytes of the padding, if not zeros
+
+  Varints are little-endian base 128: seven bits per byte, the high
+  bit is set on all but the last byte. The next_pos of raw heads is
+  not stored, it follows from the size of the data section.
+*/
+
+#define M210_ARCHIVE_NOTE 'N'
+#define M210_ARCHIVE_END 'E'
+#define M210_ARCHIVE_APPENDED 'M' /* First byte of M210_ARCHIVE_MAGIC. */
+
+#define M210_ARCHIVE_RESERVED 0x01
+#define M210_ARCHIVE_TAIL 0x02
+
+#define M210_ARCHIVE_BUFFER_SIZE 65536 /* Bytes. */
+
+/* Most bytes put to the buffer at once: an end record with the
+ * longest padding there can be. */
+#define M210_ARCHIVE_MAX_PUT (M210_DEV_PACKET_SIZE + 8)
+
+struct m210_archive_writer {
+	FILE *file;
+	size_t used;
+	uint8_t buf[M210_ARCHIVE_BUFFER_SIZE];
+};
+
+struct m210_archive_reader {
+	uint8_t const *pos;
+	uint8_t const *end;
+};
+
+struct m210_archive_output {
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+};
+
+static inline int m210_archive_is_penup(struct m210_rawnote_body const *const bodyp)
+{
+	return memcmp(bodyp, &M210_RAWNOTE_BODY_PENUP,
+		      sizeof(struct m210_rawnote_body)) == 0;
+}
+
+static inline uint16_t m210_archive_zigzag(int16_t const value)
+{
+	return (uint16_t) (((uint16_t) value << 1) ^ (uint16_t) (value >> 15));
+}
+
+static inline int16_t m210_archive_unzigzag(uint32_t const value)
+{
+	return (int16_t) ((value >> 1) ^ -(value & 1));
+}
+
+static enum m210_err m210_archive_flush(struct m210_archive_writer *const writer_ptr)
+{
+	if (writer_ptr->used
+	    && fwrite(writer_ptr->buf, writer_ptr->used, 1,
+		      writer_ptr->file) != 1) {
+		return M210_ERR_SYS;
+	}
+	writer_ptr->used = 0;
+	return M210_ERR_OK;
+}
+
+/* Makes room for M210_ARCHIVE_MAX_PUT bytes. */
+static inline enum m210_err m210_archive_reserve(struct m210_archive_writer *const writer_ptr)
+{
+	if (M210_ARCHIVE_BUFFER_SIZE - writer_ptr->used < M210_ARCHIVE_MAX_PUT) {
+		return m210_archive_flush(writer_ptr);
+	}
+	return M210_ERR_OK;
+}
+
+static inline void m210_archive_put_varint(struct m210_archive_writer *const writer_ptr,
+					   uint32_t value)
+{
+	while (value >= 0x80) {
+		writer_ptr->buf[writer_ptr->used++] = value | 0x80;
+		value >>= 7;
+	}
+	writer_ptr->buf[writer_ptr->used++] = value;
+}
+
+static void m210_archive_put_bytes(struct m210_archive_writer *const writer_ptr,
+				   void const *const bytes, size_t const size)
+{
+	memcpy(writer_ptr->buf + writer_ptr->used, bytes, size);
+	writer_ptr->used += size;
+}
+
+static enum m210_err m210_archive_put_note(struct m210_archive_writer *const writer_ptr,
+					   struct m210_rawnote_head const *const rawheadp,
+					   uint8_t const *const data,
+					   size_t const data_size)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_rawnote_body const *const rawbodies =
+		(struct m210_rawnote_body const *) data;
+	size_t const bodyc = data_size / sizeof(struct m210_rawnote_body);
+	size_t const tail_size = data_size % sizeof(struct m210_rawnote_body);
+	uint8_t const zeros[sizeof(rawheadp->reserved)] = {0};
+	uint8_t flags = 0;
+	uint16_t last_x = 0;
+	uint16_t last_y = 0;
+	size_t i = 0;
+
+	if (memcmp(rawheadp->reserved, zeros, sizeof(zeros))) {
+		flags |= M210_ARCHIVE_RESERVED;
+	}
+	if (tail_size) {
+		flags |= M210_ARCHIVE_TAIL;
+	}
+
+	err = m210_archive_reserve(writer_ptr);
+	if (err) {
+		goto out;
+	}
+	writer_ptr->buf[writer_ptr->used++] = M210_ARCHIVE_NOTE;
+	writer_ptr->buf[writer_ptr->used++] = rawheadp->state;
+	writer_ptr->buf[writer_ptr->used++] = rawheadp->number;
+	writer_ptr->buf[writer_ptr->used++] = rawheadp->last_number;
+	writer_ptr->buf[writer_ptr->used++] = flags;
+	if (flags & M210_ARCHIVE_RESERVED) {
+		m210_archive_put_bytes(writer_ptr, rawheadp->reserved,
+				       sizeof(rawheadp->reserved));
+	}
+
+	while (1) {
+		size_t end = i;
+		int penup;
+
+		while (end < bodyc && !m210_archive_is_penup(rawbodies + end)) {
+			++end;
+		}
+		penup = end < bodyc;
+
+		err = m210_archive_reserve(writer_ptr);
+		if (err) {
+			goto out;
+		}
+		m210_archive_put_varint(writer_ptr, (end - i) * 2 + penup);
+
+		for (; i < end; ++i) {
+			uint16_t x;
+			uint16_t y;
+			int16_t dx;
+			int16_t dy;
+
+			memcpy(&x, rawbodies[i].x, 2);
+			memcpy(&y, rawbodies[i].y, 2);
+			x = le16toh(x);
+			y = le16toh(y);
+			/* Wrap around, any move fits in 16 bits. */
+			dx = (int16_t) (uint16_t) (x - last_x);
+			dy = (int16_t) (uint16_t) (y - last_y);
+
+			err = m210_archive_reserve(writer_ptr);
+			if (err) {
+				goto out;
+			}
+			m210_archive_put_varint(writer_ptr, m210_archive_zigzag(dx));
+			m210_archive_put_varint(writer_ptr, m210_archive_zigzag(dy));
+			last_x = x;
+			last_y = y;
+		}
+
+		if (!penup) {
+			break;
+		}
+		/* Past the pen-up. */
+		++i;
+	}
+
+	if (flags & M210_ARCHIVE_TAIL) {
+		err = m210_archive_reserve(writer_ptr);
+		if (err) {
+			goto out;
+		}
+		m210_archive_put_varint(writer_ptr, tail_size);
+		m210_archive_put_bytes(writer_ptr, data + data_size - tail_size,
+				       tail_size);
+	}
+out:
+	return err;
+}
+
+static enum m210_err m210_archive_put_end(struct m210_archive_writer *const writer_ptr,
+					  uint8_t const *const padding,
+					  size_t const padding_size)
+{
+	enum m210_err const err = m210_archive_reserve(writer_ptr);
+	int zeros = 1;
+
+	if (err) {
+		return err;
+	}
+
+	for (size_t i = 0; i < padding_size; ++i) {
+		if (padding[i]) {
+			zeros = 0;
+			break;
+		}
+	}
+
+	writer_ptr->buf[writer_ptr->used++] = M210_ARCHIVE_END;
+	m210_archive_put_varint(writer_ptr, padding_size);
+	writer_ptr->buf[writer_ptr->used++] = !zeros;
+	if (!zeros) {
+		m210_archive_put_bytes(writer_ptr, padding, padding_size);
+	}
+	return M210_ERR_OK;
+}
+
+int m210_archive_check(uint8_t const *const data, size_t const size)
+{
+	return (size >= M210_ARCHIVE_MAGIC_SIZE
+		&& !memcmp(data, M210_ARCHIVE_MAGIC, M210_ARCHIVE_MAGIC_SIZE));
+}
+
+/*
+  Walks the dumps like m210_note_map_read() does, and fails where it
+  would.
+*/
+enum m210_err m210_archive_write(FILE *const file, uint8_t const *const dump,
+				 size_t const size)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_archive_writer *writer_ptr = NULL;
+	size_t pos = 0;
+
+	writer_ptr = malloc(sizeof(struct m210_archive_writer));
+	if (writer_ptr == NULL) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	writer_ptr->file = file;
+	writer_ptr->used = 0;
+
+	m210_archive_put_bytes(writer_ptr, M210_ARCHIVE_MAGIC,
+			       M210_ARCHIVE_MAGIC_SIZE);
+
+	while (pos < size) {
+		size_t const base = pos;
+
+		while (1) {
+			struct m210_rawnote_head rawhead;
+			size_t const bodies_pos = pos + sizeof(rawhead);
+			uint32_t next_pos = 0;
+
+			if (size - pos < sizeof(rawhead)) {
+				err = M210_ERR_UNEXPECTED_EOF;
+				goto out;
+			}
+			memcpy(&rawhead, dump + pos, sizeof(rawhead));
+
+			if (!memcmp(&rawhead, &M210_RAWNOTE_HEAD_LAST,
+				    sizeof(rawhead))) {
+				size_t padding = ((M210_DEV_PACKET_SIZE
+						   - ((bodies_pos - base)
+						      % M210_DEV_PACKET_SIZE))
+						  % M210_DEV_PACKET_SIZE);
+
+				if (size - bodies_pos < padding) {
+					padding = size - bodies_pos;
+				}
+				err = m210_archive_put_end(writer_ptr,
+							   dump + bodies_pos,
+							   padding);
+				if (err) {
+					goto out;
+				}
+				pos = bodies_pos + padding;
+				break;
+			}
+
+			memcpy(&next_pos, rawhead.next_pos, 3);
+			next_pos = le32toh(next_pos);
+			if (base + next_pos < bodies_pos) {
+				err = M210_ERR_BAD_RAWNOTE_HEAD;
+				goto out;
+			}
+			if (base + next_pos > size) {
+				err = M210_ERR_UNEXPECTED_EOF;
+				goto out;
+			}
+
+			err = m210_archive_put_note(writer_ptr, &rawhead,
+						    dump + bodies_pos,
+						    base + next_pos - bodies_pos);
+			if (err) {
+				goto out;
+			}
+			pos = base + next_pos;
+		}
+	}
+
+	err = m210_archive_flush(writer_ptr);
+out:
+	free(writer_ptr);
+	return err;
+}
+
+static inline enum m210_err m210_archive_get_varint(struct m210_archive_reader *const reader_ptr,
+						    uint32_t *const value_ptr)
+{
+	uint32_t value = 0;
+
+	for (int shift = 0; shift < 32; shift += 7) {
+		uint8_t byte;
+
+		if (reader_ptr->pos == reader_ptr->end) {
+			return M210_ERR_BAD_ARCHIVE;
+		}
+		byte = *reader_ptr->pos++;
+		value |= (uint32_t) (byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			*value_ptr = value;
+			return M210_ERR_OK;
+		}
+	}
+	return M210_ERR_BAD_ARCHIVE;
+}
+
+static enum m210_err m210_archive_get_bytes(struct m210_archive_reader *const reader_ptr,
+					    void *const bytes,
+					    size_t const size)
+{
+	if ((size_t) (reader_ptr->end - reader_ptr->pos) < size) {
+		return M210_ERR_BAD_ARCHIVE;
+	}
+	memcpy(bytes, reader_ptr->pos, size);
+	reader_ptr->pos += size;
+	return M210_ERR_OK;
+}
+
+/* Makes room for size more bytes of output. */
+static enum m210_err m210_archive_grow(struct m210_archive_output *const output_ptr,
+				       size_t const size)
+{
+	size_t capacity = output_ptr->capacity;
+	uint8_t *data;
+
+	if (size <= capacity - output_ptr->size) {
+		return M210_ERR_OK;
+	}
+
+	while (size > capacity - output_ptr->size) {
+		capacity = capacity ? capacity * 2 : M210_ARCHIVE_BUFFER_SIZE;
+	}
+	data = realloc(output_ptr->data, capacity);
+	if (data == NULL) {
+		return M210_ERR_SYS;
+	}
+	output_ptr->data = data;
+	output_ptr->capacity = capacity;
+	return M210_ERR_OK;
+}
+
+static enum m210_err m210_archive_get_note(struct m210_archive_reader *const reader_ptr,
+					   struct m210_archive_output *const output_ptr,
+					   size_t const base)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_rawnote_head rawhead;
+	size_t const head_pos = output_ptr->size;
+	uint8_t fields[4];
+	uint32_t next_pos;
+	uint16_t x = 0;
+	uint16_t y = 0;
+
+	memset(&rawhead, 0, sizeof(rawhead));
+
+	err = m210_archive_get_bytes(reader_ptr, fields, sizeof(fields));
+	if (err) {
+		goto out;
+	}
+	rawhead.state = fields[0];
+	rawhead.number = fields[1];
+	rawhead.last_number = fields[2];
+	if (fields[3] & ~(M210_ARCHIVE_RESERVED | M210_ARCHIVE_TAIL)) {
+		err = M210_ERR_BAD_ARCHIVE;
+		goto out;
+	}
+	if (fields[3] & M210_ARCHIVE_RESERVED) {
+		err = m210_archive_get_bytes(reader_ptr, rawhead.reserved,
+					     sizeof(rawhead.reserved));
+		if (err) {
+			goto out;
+		}
+	}
+
+	/* The head is written once its next_pos is known. */
+	err = m210_archive_grow(output_ptr, sizeof(rawhead));
+	if (err) {
+		goto out;
+	}
+	output_ptr->size += sizeof(rawhead);
+
+	while (1) {
+		uint32_t stroke;
+		uint32_t count;
+		uint8_t *p;
+
+		err = m210_archive_get_varint(reader_ptr, &stroke);
+		if (err) {
+			goto out;
+		}
+		count = stroke / 2;
+
+		/* Every point takes two bytes of archive at least,
+		 * do not trust a count which claims more. */
+		if (count > (size_t) (reader_ptr->end - reader_ptr->pos) / 2) {
+			err = M210_ERR_BAD_ARCHIVE;
+			goto out;
+		}
+
+		err = m210_archive_grow(output_ptr,
+					((size_t) count + 1)
+					* sizeof(struct m210_rawnote_body));
+		if (err) {
+			goto out;
+		}
+		p = output_ptr->data + output_ptr->size;
+
+		for (uint32_t i = 0; i < count; ++i) {
+			uint32_t dx;
+			uint32_t dy;
+			uint16_t lex;
+			uint16_t ley;
+
+			if (m210_archive_get_varint(reader_ptr, &dx)
+			    || m210_archive_get_varint(reader_ptr, &dy)
+			    || dx > UINT16_MAX || dy > UINT16_MAX) {
+				err = M210_ERR_BAD_ARCHIVE;
+				goto out;
+			}
+			x += (uint16_t) m210_archive_unzigzag(dx);
+			y += (uint16_t) m210_archive_unzigzag(dy);
+			lex = htole16(x);
+			ley = htole16(y);
+			memcpy(p, &lex, 2);
+			memcpy(p + 2, &ley, 2);
+			p += sizeof(struct m210_rawnote_body);
+		}
+
+		if (stroke & 1) {
+			memcpy(p, &M210_RAWNOTE_BODY_PENUP,
+			       sizeof(struct m210_rawnote_body));
+			p += sizeof(struct m210_rawnote_body);
+		}
+		output_ptr->size = p - output_ptr->data;
+
+		if (!(stroke & 1)) {
+			break;
+		}
+	}
+
+	if (fields[3] & M210_ARCHIVE_TAIL) {
+		uint32_t tail_size;
+
+		err = m210_archive_get_varint(reader_ptr, &tail_size);
+		if (err) {
+			goto out;
+		}
+		if (tail_size >= sizeof(struct m210_rawnote_body)) {
+			err = M210_ERR_BAD_ARCHIVE;
+			goto out;
+		}
+		err = m210_archive_grow(output_ptr, tail_size);
+		if (err) {
+			goto out;
+		}
+		err = m210_archive_get_bytes(reader_ptr,
+					     output_ptr->data + output_ptr->size,
+					     tail_size);
+		if (err) {
+			goto out;
+		}
+		output_ptr->size += tail_size;
+	}
+
+	/* next_pos is relative to the dump and has 24 bits. */
+	if (output_ptr->size - base > 0xffffff) {
+		err = M210_ERR_BAD_ARCHIVE;
+		goto out;
+	}
+	next_pos = htole32(output_ptr->size - base);
+	memcpy(rawhead.next_pos, &next_pos, 3);
+	memcpy(output_ptr->data + head_pos, &rawhead, sizeof(rawhead));
+out:
+	return err;
+}
+
+static enum m210_err m210_archive_get_end(struct m210_archive_reader *const reader_ptr,
+					  struct m210_archive_output *const output_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint32_t padding_size;
+	uint8_t has_bytes;
+	uint8_t *p;
+
+	err = m210_archive_get_varint(reader_ptr, &padding_size);
+	if (err) {
+		goto out;
+	}
+	err = m210_archive_get_bytes(reader_ptr, &has_bytes, 1);
+	if (err) {
+		goto out;
+	}
+	if (padding_size >= M210_DEV_PACKET_SIZE || has_bytes > 1) {
+		err = M210_ERR_BAD_ARCHIVE;
+		goto out;
+	}
+
+	err = m210_archive_grow(output_ptr, (sizeof(struct m210_rawnote_head)
+					     + padding_size));
+	if (err) {
+		goto out;
+	}
+	p = output_ptr->data + output_ptr->size;
+	memcpy(p, &M210_RAWNOTE_HEAD_LAST, sizeof(struct m210_rawnote_head));
+	p += sizeof(struct m210_rawnote_head);
+
+	if (has_bytes) {
+		err = m210_archive_get_bytes(reader_ptr, p, padding_size);
+		if (err) {
+			goto out;
+		}
+	} else {
+		memset(p, 0, padding_size);
+	}
+	output_ptr->size += sizeof(struct m210_rawnote_head) + padding_size;
+out:
+	return err;
+}
+
+enum m210_err m210_archive_decode(uint8_t **const dumpp, size_t *const sizep,
+				  uint8_t const *const data, size_t const size)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_archive_reader reader;
+	struct m210_archive_output output;
+	size_t base = 0; /* Of the current dump in the output. */
+
+	memset(&output, 0, sizeof(output));
+
+	if (!m210_archive_check(data, size)) {
+		err = M210_ERR_BAD_ARCHIVE;
+		goto out;
+	}
+	reader.pos = data + M210_ARCHIVE_MAGIC_SIZE;
+	reader.end = data + size;
+
+	/* Raw dumps are about three times the size of archives. */
+	err = m210_archive_grow(&output, size * 3);
+	if (err) {
+		goto out;
+	}
+
+	while (reader.pos < reader.end) {
+		switch (*reader.pos++) {
+		case M210_ARCHIVE_NOTE:
+			err = m210_archive_get_note(&reader, &output, base);
+			break;
+		case M210_ARCHIVE_END:
+			err = m210_archive_get_end(&reader, &output);
+			base = output.size;
+			break;
+		case M210_ARCHIVE_APPENDED:
+			/* Of an appended archive. */
+			if (base != output.size
+			    || !m210_archive_check(reader.pos - 1,
+						   reader.end - reader.pos + 1)) {
+				err = M210_ERR_BAD_ARCHIVE;
+				break;
+			}
+			reader.pos += M210_ARCHIVE_MAGIC_SIZE - 1;
+			break;
+		default:
+			err = M210_ERR_BAD_ARCHIVE;
+			break;
+		}
+		if (err) {
+			goto out;
+		}
+	}
+
+	/* Like a raw dump, an archive ends with the end of a dump. */
+	if (base != output.size) {
+		err = M210_ERR_BAD_ARCHIVE;
+		goto out;
+	}
+out:
+	if (err) {
+		free(output.data);
+		output.data = NULL;
+		output.size = 0;
+	}
+	*dumpp = output.data;
+	*sizep = output.size;
+	return err;
+}
@@ -0,0 +1,50 @@
+/* libm210
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "err.h"
+
+#define M210_ARCHIVE_MAGIC "M210ARC1"
+#define M210_ARCHIVE_MAGIC_SIZE 8
+
+/*
+  An archive holds raw dumps in a fraction of their size: strokes of
+  coordinate differences instead of bodies and pen-up sentinels. It
+  is lossless, an archive decodes to the very bytes it was written
+  from. The note map reads archives like raw dumps.
+*/
+
+/* Returns non-zero if data of size bytes starts like an archive. */
+int m210_archive_check(uint8_t const *data, size_t size);
+
+/* Writes dump of size bytes, one or more raw dumps back to back, as
+ * an archive to file. */
+enum m210_err m210_archive_write(FILE *file, uint8_t const *dump,
+				 size_t size);
+
+/* Decodes the archive of size bytes at data to the raw dump it
+ * holds. *dumpp is set to a buffer of *sizep bytes, which is
+ * freed with free(). */
+enum m210_err m210_archive_decode(uint8_t **dumpp, size_t *sizep,
+				  uint8_t const *data, size_t size);
+
+#endif /* ARCHIVE_H */
@@ -0,0 +1,179 @@
+/* libm210
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <endian.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define M210_DECODE_X86 1
+#include <immintrin.h>
+#endif
+
+#include "note.h"
+#include "rawnote.h"
+
+/*
+  A raw body read as a little-endian 32 bit word has x in the low and
+  y in the high half. A pen-up is the word 0x80000000, see
+  M210_RAWNOTE_BODY_PENUP.
+*/
+#define M210_DECODE_PENUP_WORD 0x80000000
+
+static void decode_scalar(int16_t *const xs, int16_t *const ys,
+			  uint16_t *const pressures,
+			  struct m210_rawnote_body const *const rawbodies,
+			  size_t const count)
+{
+	for (size_t i = 0; i < count; ++i) {
+		uint32_t word;
+
+		memcpy(&word, rawbodies + i, sizeof(word));
+		word = le32toh(word);
+
+		xs[i] = (int16_t) (word & 0xffff);
+		ys[i] = (int16_t) (word >> 16);
+		pressures[i] = word != M210_DECODE_PENUP_WORD;
+	}
+}
+
+#ifdef M210_DECODE_X86
+
+/* x86 is little-endian, the words need no swapping: sign-extending
+ * each half to 32 bits and packing back to 16 bits deinterleaves
+ * the coordinates. */
+
+__attribute__((target("sse2")))
+static size_t decode_sse2(int16_t *const xs, int16_t *const ys,
+			  uint16_t *const pressures,
+			  struct m210_rawnote_body const *const rawbodies,
+			  size_t const count)
+{
+	__m128i const penup = _mm_set1_epi32((int) M210_DECODE_PENUP_WORD);
+	__m128i const one = _mm_set1_epi16(1);
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m128i const a = _mm_loadu_si128((__m128i const *) (rawbodies + i));
+		__m128i const b = _mm_loadu_si128((__m128i const *) (rawbodies + i + 4));
+		__m128i const xa = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+		__m128i const xb = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+		__m128i const ya = _mm_srai_epi32(a, 16);
+		__m128i const yb = _mm_srai_epi32(b, 16);
+		/* -1 for pen-ups, 0 otherwise, so adding one yields
+		 * the pressure. */
+		__m128i const ups = _mm_packs_epi32(_mm_cmpeq_epi32(a, penup),
+						    _mm_cmpeq_epi32(b, penup));
+
+		_mm_storeu_si128((__m128i *) (xs + i), _mm_packs_epi32(xa, xb));
+		_mm_storeu_si128((__m128i *) (ys + i), _mm_packs_epi32(ya, yb));
+		_mm_storeu_si128((__m128i *) (pressures + i),
+				 _mm_add_epi16(ups, one));
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t decode_avx2(int16_t *const xs, int16_t *const ys,
+			  uint16_t *const pressures,
+			  struct m210_rawnote_body const *const rawbodies,
+			  size_t const count)
+{
+	__m256i const penup = _mm256_set1_epi32((int) M210_DECODE_PENUP_WORD);
+	__m256i const one = _mm256_set1_epi16(1);
+	size_t i;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+		__m256i const a = _mm256_loadu_si256((__m256i const *) (rawbodies + i));
+		__m256i const b = _mm256_loadu_si256((__m256i const *) (rawbodies + i + 8));
+		__m256i const xa = _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16);
+		__m256i const xb = _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16);
+		__m256i const ya = _mm256_srai_epi32(a, 16);
+		__m256i const yb = _mm256_srai_epi32(b, 16);
+		__m256i const ups = _mm256_packs_epi32(_mm256_cmpeq_epi32(a, penup),
+						       _mm256_cmpeq_epi32(b, penup));
+		/* Packing works within 128 bit lanes, restore the
+		 * order of the 64 bit quarters. */
+		__m256i const x = _mm256_permute4x64_epi64(_mm256_packs_epi32(xa, xb),
+							   0xd8);
+		__m256i const y = _mm256_permute4x64_epi64(_mm256_packs_epi32(ya, yb),
+							   0xd8);
+		__m256i const p = _mm256_permute4x64_epi64(_mm256_add_epi16(ups, one),
+							   0xd8);
+
+		_mm256_storeu_si256((__m256i *) (xs + i), x);
+		_mm256_storeu_si256((__m256i *) (ys + i), y);
+		_mm256_storeu_si256((__m256i *) (pressures + i), p);
+	}
+	return i;
+}
+
+#endif /* M210_DECODE_X86 */
+
+int m210_note_decode_bodies_with(enum m210_note_decoder const decoder,
+				  int16_t *const xs, int16_t *const ys,
+				  uint16_t *const pressures,
+				  struct m210_rawnote_body const *const rawbodies,
+				  size_t const count)
+{
+	size_t done = 0;
+
+	switch (decoder) {
+	case M210_NOTE_DECODER_AUTO:
+#ifdef M210_DECODE_X86
+		if (__builtin_cpu_supports("avx2")) {
+			done = decode_avx2(xs, ys, pressures, rawbodies, count);
+		} else if (__builtin_cpu_supports("sse2")) {
+			done = decode_sse2(xs, ys, pressures, rawbodies, count);
+		}
+#endif
+		break;
+	case M210_NOTE_DECODER_SCALAR:
+		break;
+	case M210_NOTE_DECODER_SSE2:
+#ifdef M210_DECODE_X86
+		if (__builtin_cpu_supports("sse2")) {
+			done = decode_sse2(xs, ys, pressures, rawbodies, count);
+			break;
+		}
+#endif
+		return -1;
+	case M210_NOTE_DECODER_AVX2:
+#ifdef M210_DECODE_X86
+		if (__builtin_cpu_supports("avx2")) {
+			done = decode_avx2(xs, ys, pressures, rawbodies, count);
+			break;
+		}
+#endif
+		return -1;
+	default:
+		return -1;
+	}
+
+	/* The tail, or everything if no vector unit is available. */
+	decode_scalar(xs + done, ys + done, pressures + done,
+		      rawbodies + done, count - done);
+	return 0;
+}
+
+void m210_note_decode_bodies(int16_t *const xs, int16_t *const ys,
+			     uint16_t *const pressures,
+			     struct m210_rawnote_body const *const rawbodies,
+			     size_t const count)
+{
+	m210_note_decode_bodies_with(M210_NOTE_DECODER_AUTO, xs, ys,
+				     pressures, rawbodies, count);
+}
@@ -17,8 +17,11 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <linux/hidraw.h>
@@ -28,18 +31,69 @@
 #include <libudev.h>
 
 #include "dev.h"
+#include "trace.h"
 
-#define M210_DEV_READ_INTERVAL 100000 /* Microseconds. */
 #define M210_DEV_RESPONSE_SIZE 64
 
-#define M210_DEV_PACKET_SIZE 62
+/* Longest request, without the three bytes of framing. */
+#define M210_DEV_MAX_REQUEST_SIZE 8
 
-#define M210_DEV_USB_INTERFACE_COUNT 2
+/* Early packet count probes wait this many times the slowest
+ * response seen so far, but at least M210_DEV_MIN_PROBE_TIMEOUT
+ * milliseconds. */
+#define M210_DEV_PROBE_TIMEOUT_FACTOR 8
+#define M210_DEV_MIN_PROBE_TIMEOUT 20
 
-#define M210_DEV_MAX_TIMEOUT_RETRIES 5
+/* Unanswered resend requests of a lost packet before giving up. */
+#define M210_DEV_MAX_RESEND_RETRIES 8
+
+/* Resend requests waiting for a reply at a time. */
+#define M210_DEV_RESEND_WINDOW 16
+
+/* Digitizer reports of tablet mode on interface 1. */
+#define M210_DEV_TABLET_REPORT_ID 0x08
+#define M210_DEV_TABLET_REPORT_SIZE 8
+
+/* The reader thread checks this often whether it has been told to
+ * stop, milliseconds. */
+#define M210_DEV_READER_STOP_INTERVAL 100
+
+#define M210_DEV_JOURNAL_MAGIC "M210JNL1"
+#define M210_DEV_JOURNAL_HEADER_SIZE 12
 
 struct m210_dev {
-	int fds[M210_DEV_USB_INTERFACE_COUNT];
+	struct m210_dev_transport transport;
+	struct m210_dev_timeouts timeouts;
+	int max_response_time; /* Milliseconds, -1 until measured. */
+	pthread_t reader;
+	int reader_running;
+	int reader_stop;
+	struct m210_ring *reader_ring;
+	struct m210_dev_stats stats;
+	/* Requests are framed here, there is one in flight at a
+	 * time. */
+	uint8_t request[M210_DEV_MAX_REQUEST_SIZE + 3];
+	/* Memory lent by the caller for the state of downloads, and
+	 * how much of it the current download has taken. */
+	uint8_t *arena;
+	size_t arena_size;
+	size_t arena_used;
+};
+
+static struct m210_dev_timeouts const DEFAULT_TIMEOUTS = {
+	M210_DEV_DEFAULT_FIRST_BYTE_TIMEOUT,
+	M210_DEV_DEFAULT_PACKET_TIMEOUT,
+	M210_DEV_DEFAULT_EMPTY_PROBES,
+};
+
+struct m210_dev_monitor {
+	struct udev *udev;
+	struct udev_monitor *monitor;
+	/* Devices some of whose interfaces have appeared. */
+	struct m210_dev_list pending;
+	/* Devices already there, whose add events are not reported
+	 * until they have been removed. */
+	struct m210_dev_list known;
 };
 
 struct m210_dev_packet {
@@ -53,15 +107,117 @@ static struct hidraw_devinfo const DEVINFO_M210 = {
 	0x0101,
 };
 
-static enum m210_err m210_dev_write(struct m210_dev const *const dev_ptr,
+static int m210_dev_elapsed_ms(struct timespec const *const start_ptr)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((now.tv_sec - start_ptr->tv_sec) * 1000
+		+ (now.tv_nsec - start_ptr->tv_nsec) / 1000000);
+}
+
+static unsigned long long m210_dev_elapsed_us(struct timespec const *const start_ptr)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((now.tv_sec - start_ptr->tv_sec) * 1000000LL
+		+ (now.tv_nsec - start_ptr->tv_nsec) / 1000);
+}
+
+/* The transport of physical devices. */
+struct m210_dev_hidraw {
+	int fds[M210_DEV_USB_INTERFACE_COUNT];
+};
+
+static enum m210_err m210_dev_hidraw_write(void *const arg,
+					   uint8_t const *const request,
+					   size_t const request_size)
+{
+	struct m210_dev_hidraw const *const hidraw_ptr = arg;
+
+	if (write(hidraw_ptr->fds[0], request, request_size) == -1) {
+		return M210_ERR_SYS;
+	}
+	return M210_ERR_OK;
+}
+
+static enum m210_err m210_dev_hidraw_read(void *const arg,
+					  int const interface,
+					  void *const report,
+					  size_t const report_size,
+					  size_t *const size_ptr,
+					  int const timeout)
+{
+	struct m210_dev_hidraw const *const hidraw_ptr = arg;
+	enum m210_err err = M210_ERR_OK;
+	struct pollfd pollfd;
+	struct timespec start;
+	int remaining = timeout;
+	ssize_t size;
+
+	pollfd.fd = hidraw_ptr->fds[interface];
+	pollfd.events = POLLIN;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (1) {
+		int const ready = poll(&pollfd, 1, remaining);
+
+		if (ready == -1 && errno == EINTR) {
+			if (timeout >= 0) {
+				remaining = timeout - m210_dev_elapsed_ms(&start);
+				if (remaining <= 0) {
+					err = M210_ERR_DEV_TIMEOUT;
+					goto out;
+				}
+			}
+			continue;
+		}
+		if (ready == -1) {
+			err = M210_ERR_SYS;
+			goto out;
+		}
+		if (ready == 0) {
+			err = M210_ERR_DEV_TIMEOUT;
+			goto out;
+		}
+		break;
+	}
+
+	size = read(pollfd.fd, report, report_size);
+	if (size == -1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	*size_ptr = size;
+out:
+	return err;
+}
+
+static enum m210_err m210_dev_hidraw_close(void *const arg)
+{
+	struct m210_dev_hidraw *const hidraw_ptr = arg;
+	enum m210_err err = M210_ERR_OK;
+
+	for (int i = 0; i < M210_DEV_USB_INTERFACE_COUNT; ++i) {
+		if (close(hidraw_ptr->fds[i]) == -1) {
+			err = M210_ERR_SYS;
+		}
+	}
+	free(hidraw_ptr);
+	return err;
+}
+
+static enum m210_err m210_dev_write(struct m210_dev *const dev_ptr,
 				    uint8_t const *const bytes,
 				    size_t const bytes_size)
 {
 	enum m210_err err = M210_ERR_OK;
 	size_t const request_size = bytes_size + 3;
-	uint8_t *request = malloc(request_size);
+	uint8_t *const request = dev_ptr->request;
 
-	if (request == NULL) {
+	if (bytes_size > M210_DEV_MAX_REQUEST_SIZE) {
+		errno = EINVAL;
 		err = M210_ERR_SYS;
 		goto out;
 	}
@@ -74,60 +230,233 @@ static enum m210_err m210_dev_write(struct m210_dev const *const dev_ptr,
 	memcpy(request + 3, bytes, bytes_size);
 
 	/* Send request to the interface 0. */
-	if (write(dev_ptr->fds[0], request, request_size) == -1) {
-		err = M210_ERR_SYS;
-		goto out;
+	err = dev_ptr->transport.write(dev_ptr->transport.arg, request,
+				       request_size);
+	if (!err) {
+		++dev_ptr->stats.requests;
 	}
 
 out:
-	free(request);
 	return err;
 }
 
-static enum m210_err m210_dev_read(struct m210_dev const *const dev_ptr,
+/* Waits at most timeout milliseconds for a report and reads it. On
+ * success, *elapsed_ptr is set to the time waited, unless
+ * elapsed_ptr is NULL. */
+static enum m210_err m210_dev_read(struct m210_dev *const dev_ptr,
 				   int const interface,
 				   void *const response,
-				   size_t const response_size)
+				   size_t const response_size,
+				   int const timeout,
+				   int *const elapsed_ptr)
 {
 	enum m210_err err = M210_ERR_OK;
-	fd_set readfds;
-	int const fd = dev_ptr->fds[interface];
-	static struct timeval select_interval;
+	struct timespec start;
+	unsigned long long elapsed;
+	int bucket = 0;
+	size_t size;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	err = dev_ptr->transport.read(dev_ptr->transport.arg, interface,
+				      response, response_size, &size,
+				      timeout);
+	if (err == M210_ERR_DEV_TIMEOUT) {
+		++dev_ptr->stats.timeouts;
+	}
+	if (err) {
+		goto out;
+	}
 
-	memset(&select_interval, 0, sizeof(struct timeval));
-	FD_ZERO(&readfds);
-	FD_SET(fd, &readfds);
+	elapsed = m210_dev_elapsed_us(&start);
+	while (bucket < M210_DEV_STATS_LATENCY_BUCKETS - 1
+	       && elapsed >= (1ULL << bucket)) {
+		++bucket;
+	}
+	++dev_ptr->stats.read_latencies[bucket];
+	++dev_ptr->stats.reads;
 
-	select_interval.tv_usec = M210_DEV_READ_INTERVAL;
+	if (elapsed_ptr) {
+		*elapsed_ptr = elapsed / 1000;
+	}
+out:
+	return err;
+}
 
-	switch (select(fd + 1, &readfds, NULL, NULL, &select_interval)) {
-	case 0:
-		err = M210_ERR_DEV_TIMEOUT;
-		goto out;
-	case -1:
+/* Reads a response to a request within timeout and keeps track of
+ * the slowest response of the device. */
+static enum m210_err m210_dev_read_response(struct m210_dev *const dev_ptr,
+					    void *const response,
+					    size_t const response_size,
+					    int const timeout)
+{
+	int elapsed;
+	enum m210_err const err = m210_dev_read(dev_ptr, 0, response,
+						response_size, timeout,
+						&elapsed);
+	if (!err && elapsed > dev_ptr->max_response_time) {
+		dev_ptr->max_response_time = elapsed;
+	}
+	return err;
+}
+
+/* Returns the node of the physical device at usb_syspath, appending
+ * a new one if there is none yet. */
+static struct m210_dev_node *m210_dev_list_node(struct m210_dev_list *const list_ptr,
+						char const *const usb_syspath)
+{
+	struct m210_dev_node *nodes;
+	struct m210_dev_node *node_ptr;
+
+	for (size_t i = 0; i < list_ptr->count; ++i) {
+		if (!strcmp(list_ptr->nodes[i].usb_syspath, usb_syspath)) {
+			return &list_ptr->nodes[i];
+		}
+	}
+
+	nodes = realloc(list_ptr->nodes, ((list_ptr->count + 1)
+					  * sizeof(struct m210_dev_node)));
+	if (nodes == NULL) {
+		return NULL;
+	}
+	list_ptr->nodes = nodes;
+
+	node_ptr = &nodes[list_ptr->count++];
+	memset(node_ptr, 0, sizeof(struct m210_dev_node));
+	strncpy(node_ptr->usb_syspath, usb_syspath, PATH_MAX - 1);
+	return node_ptr;
+}
+
+static int m210_dev_node_is_complete(struct m210_dev_node const *const node_ptr)
+{
+	for (int i = 0; i < M210_DEV_USB_INTERFACE_COUNT; ++i) {
+		if (!node_ptr->hidraw_paths[i][0]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Tells whether a hidraw device is an interface of an M210, and if
+ * so, which one and of which USB device. The strings are owned by
+ * device. */
+static int m210_dev_match(struct udev_device *const device,
+			  int *const iface_ptr,
+			  char const **const usb_syspath_ptr,
+			  char const **const devnode_ptr)
+{
+	struct udev_device *usb_interface;
+	struct udev_device *usb_device;
+	char const *vendor;
+	char const *product;
+	char const *ifn;
+
+	/* Parents are owned by the device. */
+	usb_interface = udev_device_get_parent_with_subsystem_devtype(
+		device, "usb", "usb_interface");
+	usb_device = udev_device_get_parent_with_subsystem_devtype(
+		device, "usb", "usb_device");
+	if (usb_interface == NULL || usb_device == NULL) {
+		return 0;
+	}
+
+	*devnode_ptr = udev_device_get_devnode(device);
+	*usb_syspath_ptr = udev_device_get_syspath(usb_device);
+	vendor = udev_device_get_sysattr_value(usb_device, "idVendor");
+	product = udev_device_get_sysattr_value(usb_device, "idProduct");
+	ifn = udev_device_get_sysattr_value(usb_interface, "bInterfaceNumber");
+	if (*devnode_ptr == NULL || *usb_syspath_ptr == NULL
+	    || vendor == NULL || product == NULL || ifn == NULL
+	    || strtol(vendor, NULL, 16) != DEVINFO_M210.vendor
+	    || strtol(product, NULL, 16) != DEVINFO_M210.product) {
+		return 0;
+	}
+
+	*iface_ptr = atoi(ifn);
+	return *iface_ptr >= 0 && *iface_ptr < M210_DEV_USB_INTERFACE_COUNT;
+}
+
+/* Adds the hidraw nodes under usb_device to list_ptr. */
+static enum m210_err m210_dev_list_add_children(struct m210_dev_list *const list_ptr,
+						struct udev *const udev,
+						struct udev_device *const usb_device)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct udev_list_entry *list_entry = NULL;
+	struct udev_enumerate *enumerate = NULL;
+
+	enumerate = udev_enumerate_new(udev);
+	if (enumerate == NULL) {
 		err = M210_ERR_SYS;
 		goto out;
-	default:
-		break;
 	}
 
-	if (read(fd, response, response_size) == -1) {
+	if (udev_enumerate_add_match_parent(enumerate, usb_device)
+	    || udev_enumerate_add_match_subsystem(enumerate, "hidraw")
+	    || udev_enumerate_scan_devices(enumerate)) {
 		err = M210_ERR_SYS;
 		goto out;
 	}
 
+	list_entry = udev_enumerate_get_list_entry(enumerate);
+
+	for (; list_entry; list_entry = udev_list_entry_get_next(list_entry)) {
+		char const *syspath = udev_list_entry_get_name(list_entry);
+		struct udev_device *device;
+		char const *usb_syspath;
+		char const *devnode;
+		int iface;
+		struct m210_dev_node *node_ptr;
+
+		device = udev_device_new_from_syspath(udev, syspath);
+		if (device == NULL) {
+			continue;
+		}
+
+		if (!m210_dev_match(device, &iface, &usb_syspath, &devnode)) {
+			udev_device_unref(device);
+			continue;
+		}
+
+		node_ptr = m210_dev_list_node(list_ptr, usb_syspath);
+		if (node_ptr == NULL) {
+			udev_device_unref(device);
+			err = M210_ERR_SYS;
+			goto out;
+		}
+		strncpy(node_ptr->hidraw_paths[iface], devnode, PATH_MAX - 1);
+		udev_device_unref(device);
+	}
 out:
+	if (enumerate) {
+		udev_enumerate_unref(enumerate);
+	}
 	return err;
 }
 
-static enum m210_err m210_dev_find_hidraw_devnode(int const iface,
-						  char *const path_ptr,
-						  size_t const path_size)
+/*
+  Finds every attached M210. udev is asked only for USB devices with
+  the vendor and product of an M210, and only their hidraw nodes are
+  looked at, grouped by USB device so both interfaces are resolved
+  at once. Other devices are never looked at beyond their IDs.
+*/
+enum m210_err m210_dev_list_find(struct m210_dev_list *const list_ptr)
 {
 	enum m210_err err = M210_ERR_OK;
 	struct udev_list_entry *list_entry = NULL;
 	struct udev_enumerate *enumerate = NULL;
 	struct udev *udev = NULL;
+	size_t complete_count = 0;
+	char vendor[5];
+	char product[5];
+
+	memset(list_ptr, 0, sizeof(struct m210_dev_list));
+
+	/* As the kernel formats them in sysfs. */
+	snprintf(vendor, sizeof(vendor), "%04x",
+		 (unsigned) (uint16_t) DEVINFO_M210.vendor);
+	snprintf(product, sizeof(product), "%04x",
+		 (unsigned) (uint16_t) DEVINFO_M210.product);
 
 	udev = udev_new();
 	if (udev == NULL) {
@@ -141,7 +470,10 @@ static enum m210_err m210_dev_find_hidraw_devnode(int const iface,
 		goto out;
 	}
 
-	if (udev_enumerate_add_match_subsystem(enumerate, "hidraw")) {
+	if (udev_enumerate_add_match_subsystem(enumerate, "usb")
+	    || udev_enumerate_add_match_sysattr(enumerate, "idVendor", vendor)
+	    || udev_enumerate_add_match_sysattr(enumerate, "idProduct",
+						product)) {
 		err = M210_ERR_SYS;
 		goto out;
 	}
@@ -153,44 +485,42 @@ static enum m210_err m210_dev_find_hidraw_devnode(int const iface,
 
 	list_entry = udev_enumerate_get_list_entry(enumerate);
 
-	while (list_entry != NULL) {
-		int ifn;
-		uint16_t vendor;
-		uint16_t product;
-		char const *syspath;
-		struct udev_device *device;
-		char const *devnode;
-		struct udev_device *parent;
+	for (; list_entry; list_entry = udev_list_entry_get_next(list_entry)) {
+		char const *syspath = udev_list_entry_get_name(list_entry);
+		struct udev_device *usb_device;
+		char const *devtype;
 
-		syspath =  udev_list_entry_get_name(list_entry);
-		device = udev_device_new_from_syspath(udev, syspath);
-		devnode = udev_device_get_devnode(device);
-
-		/* Second parent: usb */
-		parent = udev_device_get_parent(device);
-		parent = udev_device_get_parent(parent);
-
-		ifn = atoi(udev_device_get_sysattr_value(parent,
-							 "bInterfaceNumber"));
-		parent = udev_device_get_parent(parent);
-		vendor = strtol(udev_device_get_sysattr_value(parent,
-							      "idVendor"),
-				NULL, 16);
-		product = strtol(udev_device_get_sysattr_value(parent,
-							       "idProduct"),
-				 NULL, 16);
-		if (vendor == DEVINFO_M210.vendor
-		    && product == DEVINFO_M210.product
-		    && iface == ifn) {
-			strncpy(path_ptr, devnode, path_size);
-			udev_device_unref(device);
+		usb_device = udev_device_new_from_syspath(udev, syspath);
+		if (usb_device == NULL) {
+			continue;
+		}
+
+		/* Interfaces have no IDs of their own, but be sure. */
+		devtype = udev_device_get_devtype(usb_device);
+		if (devtype == NULL || strcmp(devtype, "usb_device")) {
+			udev_device_unref(usb_device);
+			continue;
+		}
+
+		err = m210_dev_list_add_children(list_ptr, udev, usb_device);
+		udev_device_unref(usb_device);
+		if (err) {
 			goto out;
 		}
-		list_entry = udev_list_entry_get_next(list_entry);
-		udev_device_unref(device);
 	}
-	err = M210_ERR_NO_DEV;
+
+	/* Keep only devices which have all their interfaces. */
+	for (size_t i = 0; i < list_ptr->count; ++i) {
+		if (m210_dev_node_is_complete(&list_ptr->nodes[i])) {
+			list_ptr->nodes[complete_count++] = list_ptr->nodes[i];
+		}
+	}
+	list_ptr->count = complete_count;
 out:
+	if (err) {
+		m210_dev_list_free(list_ptr);
+	}
+
 	if (enumerate) {
 		udev_enumerate_unref(enumerate);
 	}
@@ -202,23 +532,227 @@ out:
 	return err;
 }
 
-static enum m210_err m210_dev_accept_download(struct m210_dev const *const dev_ptr)
+void m210_dev_list_free(struct m210_dev_list *const list_ptr)
+{
+	free(list_ptr->nodes);
+	memset(list_ptr, 0, sizeof(struct m210_dev_list));
+}
+
+enum m210_err m210_dev_monitor_new(struct m210_dev_monitor **const monitor_ptr_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_dev_monitor *monitor_ptr;
+
+	monitor_ptr = calloc(1, sizeof(struct m210_dev_monitor));
+	if (monitor_ptr == NULL) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	monitor_ptr->udev = udev_new();
+	if (monitor_ptr->udev == NULL) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	/* Events from udev rather than the kernel, so that device
+	 * nodes have their permissions once an event arrives. */
+	monitor_ptr->monitor = udev_monitor_new_from_netlink(monitor_ptr->udev,
+							     "udev");
+	if (monitor_ptr->monitor == NULL) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	if (udev_monitor_filter_add_match_subsystem_devtype(monitor_ptr->monitor,
+							    "hidraw", NULL)
+	    || udev_monitor_enable_receiving(monitor_ptr->monitor)) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+out:
+	if (err) {
+		m210_dev_monitor_free(&monitor_ptr);
+	}
+	*monitor_ptr_ptr = monitor_ptr;
+	return err;
+}
+
+void m210_dev_monitor_free(struct m210_dev_monitor **const monitor_ptr_ptr)
+{
+	struct m210_dev_monitor *const monitor_ptr = *monitor_ptr_ptr;
+
+	if (monitor_ptr == NULL) {
+		return;
+	}
+
+	if (monitor_ptr->monitor) {
+		udev_monitor_unref(monitor_ptr->monitor);
+	}
+	if (monitor_ptr->udev) {
+		udev_unref(monitor_ptr->udev);
+	}
+	m210_dev_list_free(&monitor_ptr->pending);
+	m210_dev_list_free(&monitor_ptr->known);
+	free(monitor_ptr);
+	*monitor_ptr_ptr = NULL;
+}
+
+enum m210_err m210_dev_monitor_ignore(struct m210_dev_monitor *const monitor_ptr,
+				      struct m210_dev_node const *const node_ptr)
+{
+	struct m210_dev_node *const known_node_ptr = m210_dev_list_node(
+		&monitor_ptr->known, node_ptr->usb_syspath);
+
+	if (known_node_ptr == NULL) {
+		return M210_ERR_SYS;
+	}
+	*known_node_ptr = *node_ptr;
+	return M210_ERR_OK;
+}
+
+/* Forgets the interface whose hidraw node was devnode, and a known
+ * device it belonged to. */
+static void m210_dev_monitor_remove(struct m210_dev_monitor *const monitor_ptr,
+				    char const *const devnode)
+{
+	struct m210_dev_list *const pending_ptr = &monitor_ptr->pending;
+	struct m210_dev_list *const known_ptr = &monitor_ptr->known;
+
+	for (size_t i = 0; i < pending_ptr->count; ++i) {
+		for (int j = 0; j < M210_DEV_USB_INTERFACE_COUNT; ++j) {
+			if (!strcmp(pending_ptr->nodes[i].hidraw_paths[j],
+				    devnode)) {
+				pending_ptr->nodes[i].hidraw_paths[j][0] = '\0';
+			}
+		}
+	}
+
+	for (size_t i = 0; i < known_ptr->count;) {
+		int is_removed = 0;
+
+		for (int j = 0; j < M210_DEV_USB_INTERFACE_COUNT; ++j) {
+			if (!strcmp(known_ptr->nodes[i].hidraw_paths[j],
+				    devnode)) {
+				is_removed = 1;
+			}
+		}
+		if (is_removed) {
+			known_ptr->nodes[i] = known_ptr->nodes[--known_ptr->count];
+		} else {
+			++i;
+		}
+	}
+}
+
+/* Tells whether node is a known device, and forgets it if so: its
+ * add event has now been seen. */
+static int m210_dev_monitor_take_known(struct m210_dev_monitor *const monitor_ptr,
+				       struct m210_dev_node const *const node_ptr)
+{
+	struct m210_dev_list *const known_ptr = &monitor_ptr->known;
+
+	for (size_t i = 0; i < known_ptr->count; ++i) {
+		if (!memcmp(&known_ptr->nodes[i], node_ptr,
+			    sizeof(struct m210_dev_node))) {
+			known_ptr->nodes[i] = known_ptr->nodes[--known_ptr->count];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+enum m210_err m210_dev_monitor_receive(struct m210_dev_monitor *const monitor_ptr,
+				       struct m210_dev_node *const node_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_dev_list *const pending_ptr = &monitor_ptr->pending;
+	struct pollfd pollfd;
+
+	pollfd.fd = udev_monitor_get_fd(monitor_ptr->monitor);
+	pollfd.events = POLLIN;
+
+	while (1) {
+		struct udev_device *device;
+		char const *action;
+		char const *usb_syspath;
+		char const *devnode;
+		int iface;
+		struct m210_dev_node *pending_node_ptr;
+
+		if (poll(&pollfd, 1, -1) == -1) {
+			err = M210_ERR_SYS;
+			goto out;
+		}
+
+		device = udev_monitor_receive_device(monitor_ptr->monitor);
+		if (device == NULL) {
+			continue;
+		}
+
+		action = udev_device_get_action(device);
+		if (action && !strcmp(action, "remove")) {
+			devnode = udev_device_get_devnode(device);
+			if (devnode) {
+				m210_dev_monitor_remove(monitor_ptr, devnode);
+			}
+			udev_device_unref(device);
+			continue;
+		}
+
+		if (action == NULL || strcmp(action, "add")
+		    || !m210_dev_match(device, &iface, &usb_syspath,
+				       &devnode)) {
+			udev_device_unref(device);
+			continue;
+		}
+
+		pending_node_ptr = m210_dev_list_node(pending_ptr, usb_syspath);
+		if (pending_node_ptr == NULL) {
+			udev_device_unref(device);
+			err = M210_ERR_SYS;
+			goto out;
+		}
+		strncpy(pending_node_ptr->hidraw_paths[iface], devnode,
+			PATH_MAX - 1);
+		udev_device_unref(device);
+
+		if (m210_dev_node_is_complete(pending_node_ptr)) {
+			*node_ptr = *pending_node_ptr;
+			*pending_node_ptr = pending_ptr->nodes[--pending_ptr->count];
+			if (!m210_dev_monitor_take_known(monitor_ptr, node_ptr)) {
+				break;
+			}
+		}
+	}
+out:
+	return err;
+}
+
+static enum m210_err m210_dev_accept_download(struct m210_dev *const dev_ptr)
 {
 	uint8_t const bytes[] = {0xb6};
 	return m210_dev_write(dev_ptr, bytes, sizeof(bytes));
 }
 
-static enum m210_err m210_dev_reject_download(struct m210_dev const *const dev_ptr)
+static enum m210_err m210_dev_reject_download(struct m210_dev *const dev_ptr)
 {
 	uint8_t const bytes[] = {0xb7};
 	return m210_dev_write(dev_ptr, bytes, sizeof(bytes));
 }
 
-static enum m210_err m210_dev_connect_hidraw(struct m210_dev *const dev_ptr,
-					     char *const *const hidraw_path_ptrs)
+static enum m210_err m210_dev_open_hidraw(struct m210_dev_transport *const transport_ptr,
+					  char const *const *const hidraw_path_ptrs)
 {
 	enum m210_err err = M210_ERR_OK;
-	int fds[M210_DEV_USB_INTERFACE_COUNT];
+	struct m210_dev_hidraw *hidraw_ptr = NULL;
+	size_t opened_count = 0;
+
+	hidraw_ptr = malloc(sizeof(struct m210_dev_hidraw));
+	if (hidraw_ptr == NULL) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
 
 	for (size_t i = 0; i < M210_DEV_USB_INTERFACE_COUNT; ++i) {
 		struct hidraw_devinfo devinfo;
@@ -227,6 +761,7 @@ static enum m210_err m210_dev_connect_hidraw(struct m210_dev *const dev_ptr,
 			err = M210_ERR_SYS;
 			goto out;
 		}
+		hidraw_ptr->fds[opened_count++] = fd;
 
 		if (ioctl(fd, HIDIOCGRAWINFO, &devinfo)) {
 			err = M210_ERR_SYS;
@@ -238,13 +773,21 @@ static enum m210_err m210_dev_connect_hidraw(struct m210_dev *const dev_ptr,
 			err = M210_ERR_BAD_DEV;
 			goto out;
 		}
-
-		fds[i] = fd;
 	}
 
 out:
-	if (!err) {
-		memcpy(dev_ptr->fds, fds, sizeof(fds));
+	if (err) {
+		int const original_errno = errno;
+		while (opened_count) {
+			close(hidraw_ptr->fds[--opened_count]);
+		}
+		free(hidraw_ptr);
+		errno = original_errno;
+	} else {
+		transport_ptr->write = m210_dev_hidraw_write;
+		transport_ptr->read = m210_dev_hidraw_read;
+		transport_ptr->close = m210_dev_hidraw_close;
+		transport_ptr->arg = hidraw_ptr;
 	}
 	return err;
 }
@@ -280,22 +823,57 @@ out:
   ACCEPT	    >
 
 */
-static enum m210_err m210_dev_begin_download(struct m210_dev const *const dev_ptr,
-					     uint16_t *const packet_count_ptr)
+/*
+  Returns the deadline of a packet count probe. The device does not
+  answer the probe at all if it has no notes, so a timeout is the
+  expected outcome with an empty device. Once the device has
+  answered something, the early probes wait only a few times longer
+  than it has ever taken to answer. The last probe always waits the
+  full first byte timeout, so a slow device is never mistaken for an
+  empty one.
+*/
+static int m210_dev_probe_timeout(struct m210_dev const *const dev_ptr,
+				  int const probe)
 {
-	static uint8_t const bytes[] = {0xb5};
-	uint8_t response[] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
-	enum m210_err err = M210_ERR_OK;
-	int timeout_retries = 0;
+	int const timeout = dev_ptr->timeouts.first_byte;
+	int adaptive;
 
-	while (timeout_retries < M210_DEV_MAX_TIMEOUT_RETRIES) {
-		err = m210_dev_write(dev_ptr, bytes, sizeof(bytes));
+	if (probe + 1 >= dev_ptr->timeouts.empty_probes
+	    || dev_ptr->max_response_time < 0) {
+		return timeout;
+	}
+
+	adaptive = M210_DEV_PROBE_TIMEOUT_FACTOR * dev_ptr->max_response_time;
+	if (adaptive < M210_DEV_MIN_PROBE_TIMEOUT) {
+		adaptive = M210_DEV_MIN_PROBE_TIMEOUT;
+	}
+	return adaptive < timeout ? adaptive : timeout;
+}
+
+static enum m210_err m210_dev_begin_download(struct m210_dev *const dev_ptr,
+					     uint16_t *const packet_count_ptr)
+{
+	static uint8_t const bytes[] = {0xb5};
+	uint8_t response[] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+	enum m210_err err = M210_ERR_OK;
+	struct timespec start;
+	int probe = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (probe < dev_ptr->timeouts.empty_probes) {
+		int const timeout = m210_dev_probe_timeout(dev_ptr, probe);
+
+		err = m210_dev_write(dev_ptr, bytes, sizeof(bytes));
 		if (err) {
 			goto out;
 		}
-		++timeout_retries;
+		if (probe++) {
+			++dev_ptr->stats.begin_retries;
+		}
 
-		err = m210_dev_read(dev_ptr, 0, response, sizeof(response));
+		err = m210_dev_read_response(dev_ptr, response,
+					     sizeof(response), timeout);
 		if (err) {
 			if (err == M210_ERR_DEV_TIMEOUT) {
 				/* In addition to typical reasons for
@@ -341,49 +919,95 @@ out:
 			m210_dev_reject_download(dev_ptr);
 		}
 	}
+	dev_ptr->stats.begin_time += m210_dev_elapsed_us(&start);
 	return err;
 }
 
-static enum m210_err m210_dev_read_packet(struct m210_dev const *const dev_ptr,
-					  struct m210_dev_packet *const packet_ptr)
+static enum m210_err m210_dev_read_packet(struct m210_dev *const dev_ptr,
+					  struct m210_dev_packet *const packet_ptr,
+					  int const timeout)
 {
 	enum m210_err err = m210_dev_read(dev_ptr, 0, packet_ptr,
-					  sizeof(struct m210_dev_packet));
+					  sizeof(struct m210_dev_packet),
+					  timeout, NULL);
 	if (!err) {
 		packet_ptr->num = be16toh(packet_ptr->num);
 	}
 	return err;
 }
 
-enum m210_err m210_dev_connect(struct m210_dev **const dev_ptr_ptr)
+enum m210_err m210_dev_connect_transport(struct m210_dev **const dev_ptr_ptr,
+					 struct m210_dev_transport const *const transport_ptr)
 {
 	struct m210_dev *dev_ptr = NULL;
 	enum m210_err err = M210_ERR_OK;
-	char iface0_path[PATH_MAX];
-	char iface1_path[PATH_MAX];
-	char *paths[M210_DEV_USB_INTERFACE_COUNT] = {iface0_path, iface1_path};
 
 	dev_ptr = malloc(sizeof(struct m210_dev));
 	if (!dev_ptr) {
 		err = M210_ERR_SYS;
+		if (transport_ptr->close) {
+			int const original_errno = errno;
+			transport_ptr->close(transport_ptr->arg);
+			errno = original_errno;
+		}
 		goto out;
 	}
 
-	for (size_t i = 0; i < M210_DEV_USB_INTERFACE_COUNT; ++i) {
-		memset(paths[i], 0, PATH_MAX);
+	dev_ptr->transport = *transport_ptr;
+	dev_ptr->timeouts = DEFAULT_TIMEOUTS;
+	dev_ptr->max_response_time = -1;
+	dev_ptr->reader_running = 0;
+	memset(&dev_ptr->stats, 0, sizeof(struct m210_dev_stats));
+	dev_ptr->arena = NULL;
+	dev_ptr->arena_size = 0;
+	dev_ptr->arena_used = 0;
+out:
+	*dev_ptr_ptr = dev_ptr;
+	return err;
+}
 
-		err = m210_dev_find_hidraw_devnode(i, paths[i], PATH_MAX);
-		if (err) {
-			goto out;
-		}
+enum m210_err m210_dev_connect_node(struct m210_dev **const dev_ptr_ptr,
+				   struct m210_dev_node const *const node_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_dev_transport transport;
+	char const *paths[M210_DEV_USB_INTERFACE_COUNT];
+
+	*dev_ptr_ptr = NULL;
+
+	for (size_t i = 0; i < M210_DEV_USB_INTERFACE_COUNT; ++i) {
+		paths[i] = node_ptr->hidraw_paths[i];
 	}
-	err = m210_dev_connect_hidraw(dev_ptr, paths);
+	err = m210_dev_open_hidraw(&transport, paths);
+	if (err) {
+		goto out;
+	}
+
+	err = m210_dev_connect_transport(dev_ptr_ptr, &transport);
 out:
+	return err;
+}
+
+enum m210_err m210_dev_connect(struct m210_dev **const dev_ptr_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_dev_list list;
+
+	*dev_ptr_ptr = NULL;
+
+	err = m210_dev_list_find(&list);
 	if (err) {
-		free(dev_ptr);
-		dev_ptr = NULL;
+		goto out;
 	}
-	*dev_ptr_ptr = dev_ptr;
+
+	if (list.count == 0) {
+		err = M210_ERR_NO_DEV;
+		goto out;
+	}
+
+	err = m210_dev_connect_node(dev_ptr_ptr, &list.nodes[0]);
+out:
+	m210_dev_list_free(&list);
 	return err;
 }
 
@@ -396,10 +1020,11 @@ enum m210_err m210_dev_disconnect(struct m210_dev **const dev_ptr_ptr)
 		goto out;
 	}
 
-	for (int i = 0; i < M210_DEV_USB_INTERFACE_COUNT; ++i) {
-		if (close(dev_ptr->fds[i]) == -1) {
-			err = M210_ERR_SYS;
-		}
+	err = m210_dev_stop_reader(dev_ptr);
+
+	if (dev_ptr->transport.close
+	    && dev_ptr->transport.close(dev_ptr->transport.arg)) {
+		err = M210_ERR_SYS;
 	}
 	free(dev_ptr);
 	*dev_ptr_ptr = NULL;
@@ -407,6 +1032,81 @@ out:
 	return err;
 }
 
+enum m210_err m210_dev_record(struct m210_dev *const dev_ptr,
+			      FILE *const file)
+{
+	return m210_trace_record(&dev_ptr->transport, file);
+}
+
+void m210_dev_get_stats(struct m210_dev *const dev_ptr,
+			struct m210_dev_stats *const stats_ptr)
+{
+	*stats_ptr = dev_ptr->stats;
+}
+
+void m210_dev_reset_stats(struct m210_dev *const dev_ptr)
+{
+	memset(&dev_ptr->stats, 0, sizeof(struct m210_dev_stats));
+}
+
+void m210_dev_set_arena(struct m210_dev *const dev_ptr, void *const arena,
+			size_t const arena_size)
+{
+	dev_ptr->arena = arena;
+	dev_ptr->arena_size = arena == NULL ? 0 : arena_size;
+	dev_ptr->arena_used = 0;
+}
+
+/* Takes size bytes for the current download from the arena, or
+ * from the heap if there is no arena or it is full. Zeroed if zero
+ * is set. */
+static void *m210_dev_alloc(struct m210_dev *const dev_ptr,
+			    size_t const size, int const zero)
+{
+	void *ptr;
+
+	if (size <= dev_ptr->arena_size - dev_ptr->arena_used) {
+		ptr = dev_ptr->arena + dev_ptr->arena_used;
+		dev_ptr->arena_used += size;
+		if (zero) {
+			memset(ptr, 0, size);
+		}
+		return ptr;
+	}
+	return zero ? calloc(size, 1) : malloc(size);
+}
+
+/* Gives back memory of m210_dev_alloc(). The arena is reclaimed
+ * as a whole when the next download begins. */
+static void m210_dev_release(struct m210_dev const *const dev_ptr,
+			     void *const ptr)
+{
+	uint8_t const *const p = ptr;
+
+	if (p >= dev_ptr->arena && p < dev_ptr->arena + dev_ptr->arena_size) {
+		return;
+	}
+	free(ptr);
+}
+
+void m210_dev_get_timeouts(struct m210_dev *const dev_ptr,
+			   struct m210_dev_timeouts *const timeouts_ptr)
+{
+	*timeouts_ptr = dev_ptr->timeouts;
+}
+
+enum m210_err m210_dev_set_timeouts(struct m210_dev *const dev_ptr,
+				    struct m210_dev_timeouts const *const timeouts_ptr)
+{
+	if (timeouts_ptr->first_byte <= 0 || timeouts_ptr->packet <= 0
+	    || timeouts_ptr->empty_probes <= 0) {
+		errno = EINVAL;
+		return M210_ERR_SYS;
+	}
+	dev_ptr->timeouts = *timeouts_ptr;
+	return M210_ERR_OK;
+}
+
 /*
   Return the total size of notes in bytes. Theoretical maximum size
   is 4063232:
@@ -422,7 +1122,7 @@ out:
   more than the maximum number of bytes in devices memory.
 
 */
-static enum m210_err m210_dev_get_notes_size(struct m210_dev const *const dev_ptr,
+static enum m210_err m210_dev_get_notes_size(struct m210_dev *const dev_ptr,
 					     uint32_t *const size_ptr)
 {
 	uint16_t packet_count = 0;
@@ -456,7 +1156,9 @@ enum m210_err m210_dev_get_info(struct m210_dev *const dev_ptr,
 
 	while (1) {
 		memset(response, 0, sizeof(response));
-		err = m210_dev_read(dev_ptr, 0, response, sizeof(response));
+		err = m210_dev_read_response(dev_ptr, response,
+					     sizeof(response),
+					     dev_ptr->timeouts.first_byte);
 		if (err) {
 			goto out;
 		}
@@ -489,78 +1191,642 @@ out:
 	return err;
 }
 
+enum m210_err m210_dev_set_mode(struct m210_dev *const dev_ptr,
+				uint8_t const mode)
+{
+	/* The LED tells the user which mode is on. */
+	uint8_t const led = mode == M210_DEV_MODE_TABLET ? 0x01 : 0x02;
+	uint8_t const bytes[] = {0x80, 0xb5, led, mode};
+	return m210_dev_write(dev_ptr, bytes, sizeof(bytes));
+}
+
+/*
+  Tablet mode report:
+
+  * 1 byte: report id, 0x08
+  * 2 bytes: x, little-endian
+  * 2 bytes: y, little-endian
+  * 1 byte: state, M210_DEV_SAMPLE_* bits
+  * 2 bytes: tip pressure, little-endian
+*/
+static void m210_dev_decode_sample(struct m210_dev_sample *const sample_ptr,
+				   uint8_t const *const report)
+{
+	sample_ptr->x = report[1] | (report[2] << 8);
+	sample_ptr->y = report[3] | (report[4] << 8);
+	sample_ptr->state = report[5];
+	sample_ptr->pressure = report[6] | (report[7] << 8);
+}
+
+enum m210_err m210_dev_read_sample(struct m210_dev *const dev_ptr,
+				   struct m210_dev_sample *const sample_ptr,
+				   int const timeout)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct timespec start;
+	int remaining = timeout;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (1) {
+		uint8_t report[M210_DEV_RESPONSE_SIZE];
+		size_t report_size;
+
+		err = dev_ptr->transport.read(dev_ptr->transport.arg, 1,
+					      report, sizeof(report),
+					      &report_size, remaining);
+		if (err) {
+			goto out;
+		}
+
+		/* Stamped right away, before anything else can delay
+		 * it. */
+		clock_gettime(CLOCK_MONOTONIC, &sample_ptr->time);
+
+		if (report_size >= M210_DEV_TABLET_REPORT_SIZE
+		    && report[0] == M210_DEV_TABLET_REPORT_ID) {
+			m210_dev_decode_sample(sample_ptr, report);
+			goto out;
+		}
+		/* Other reports are of no interest. */
+
+		if (timeout >= 0) {
+			remaining = timeout - m210_dev_elapsed_ms(&start);
+			if (remaining <= 0) {
+				err = M210_ERR_DEV_TIMEOUT;
+				goto out;
+			}
+		}
+	}
+out:
+	return err;
+}
+
+static void *m210_dev_reader(void *const arg)
+{
+	struct m210_dev *const dev_ptr = arg;
+
+	while (!__atomic_load_n(&dev_ptr->reader_stop, __ATOMIC_RELAXED)) {
+		struct m210_dev_sample sample;
+		enum m210_err err;
+
+		err = m210_dev_read_sample(dev_ptr, &sample,
+					   M210_DEV_READER_STOP_INTERVAL);
+		if (err == M210_ERR_DEV_TIMEOUT) {
+			continue;
+		}
+		if (err) {
+			m210_ring_close(dev_ptr->reader_ring, err);
+			break;
+		}
+		/* A full ring drops the sample and counts it, the
+		 * device is read on regardless. */
+		m210_ring_push(dev_ptr->reader_ring, &sample);
+	}
+	return NULL;
+}
+
+enum m210_err m210_dev_start_reader(struct m210_dev *const dev_ptr,
+				    struct m210_ring *const ring_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	int error;
+
+	if (dev_ptr->reader_running) {
+		errno = EBUSY;
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	dev_ptr->reader_ring = ring_ptr;
+	dev_ptr->reader_stop = 0;
+	error = pthread_create(&dev_ptr->reader, NULL, m210_dev_reader,
+			       dev_ptr);
+	if (error) {
+		errno = error;
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	dev_ptr->reader_running = 1;
+out:
+	return err;
+}
+
+enum m210_err m210_dev_stop_reader(struct m210_dev *const dev_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	int error;
+
+	if (!dev_ptr->reader_running) {
+		goto out;
+	}
+
+	__atomic_store_n(&dev_ptr->reader_stop, 1, __ATOMIC_RELAXED);
+	error = pthread_join(dev_ptr->reader, NULL);
+	if (error) {
+		errno = error;
+		err = M210_ERR_SYS;
+	}
+	dev_ptr->reader_running = 0;
+out:
+	return err;
+}
+
 enum m210_err m210_dev_delete_notes(struct m210_dev *const dev_ptr)
 {
 	uint8_t const bytes[] = {0xb0};
 	return m210_dev_write(dev_ptr, bytes, sizeof(bytes));
 }
 
-static enum m210_err m210_dev_download(struct m210_dev const *const dev_ptr,
-				       uint16_t packet_count,
-				       uint16_t *const lost_nums,
-				       FILE *const file)
+/*
+  Packets are stored by their number, whatever order they arrive
+  in, and a bitmap tells which ones are there. The sink is fed the
+  longest complete prefix as soon as it grows.
+*/
+struct m210_dev_reassembly {
+	uint8_t *data;
+	uint8_t *received; /* Bit i is set if packet i + 1 is in data. */
+	uint16_t packet_count;
+	uint16_t received_count;
+	uint16_t delivered_count;
+	FILE *journal; /* Received packets are appended here if set. */
+	/* Packets received and delivered are counted here if set,
+	 * those loaded from a journal are not. */
+	struct m210_dev_stats *stats;
+};
+
+static enum m210_err m210_dev_reassembly_init(struct m210_dev *const dev_ptr,
+					      struct m210_dev_reassembly *const reassembly_ptr,
+					      uint16_t const packet_count)
 {
 	enum m210_err err = M210_ERR_OK;
-	uint16_t lost_count = 0;
 
-	for (int i = 0; i < packet_count; ++i) {
-		struct m210_dev_packet packet;
-		uint16_t const expected_packet_number = i + 1;
+	memset(reassembly_ptr, 0, sizeof(struct m210_dev_reassembly));
+	reassembly_ptr->packet_count = packet_count;
 
-		err = m210_dev_read_packet(dev_ptr, &packet);
-		if (err) {
+	reassembly_ptr->data = m210_dev_alloc(dev_ptr,
+					      packet_count * M210_DEV_PACKET_SIZE,
+					      0);
+	if (reassembly_ptr->data == NULL) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	reassembly_ptr->received = m210_dev_alloc(dev_ptr,
+						  (packet_count + 7) / 8, 1);
+	if (reassembly_ptr->received == NULL) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+out:
+	return err;
+}
+
+static void m210_dev_reassembly_free(struct m210_dev const *const dev_ptr,
+				     struct m210_dev_reassembly *const reassembly_ptr)
+{
+	m210_dev_release(dev_ptr, reassembly_ptr->data);
+	m210_dev_release(dev_ptr, reassembly_ptr->received);
+	memset(reassembly_ptr, 0, sizeof(struct m210_dev_reassembly));
+}
+
+static int m210_dev_reassembly_has(struct m210_dev_reassembly const *const reassembly_ptr,
+				   uint16_t const packet_num)
+{
+	uint16_t const i = packet_num - 1;
+	return (reassembly_ptr->received[i / 8] >> (i % 8)) & 1;
+}
+
+/* Stores a packet unless it is out of range or a duplicate, and
+ * passes the complete prefix on to the sink. */
+static enum m210_err m210_dev_reassembly_put(struct m210_dev_reassembly *const reassembly_ptr,
+					     struct m210_dev_packet const *const packet_ptr,
+					     struct m210_dev_sink const *const sink_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_dev_stats *const stats_ptr = reassembly_ptr->stats;
+	uint16_t const i = packet_ptr->num - 1;
+	struct timespec start;
+
+	if (stats_ptr) {
+		++stats_ptr->packets;
+	}
+
+	if (packet_ptr->num == 0
+	    || packet_ptr->num > reassembly_ptr->packet_count
+	    || m210_dev_reassembly_has(reassembly_ptr, packet_ptr->num)) {
+		if (stats_ptr) {
+			++stats_ptr->duplicates;
+		}
+		goto out;
+	}
+
+	if (reassembly_ptr->journal) {
+		uint16_t const num = htobe16(packet_ptr->num);
+
+		if (fwrite(&num, sizeof(num), 1, reassembly_ptr->journal) != 1
+		    || fwrite(packet_ptr->data, sizeof(packet_ptr->data), 1,
+			      reassembly_ptr->journal) != 1) {
+			err = M210_ERR_SYS;
 			goto out;
 		}
+	}
 
-		if (packet.num != expected_packet_number) {
-			lost_nums[lost_count++] = expected_packet_number;
+	memcpy(reassembly_ptr->data + i * M210_DEV_PACKET_SIZE,
+	       packet_ptr->data, M210_DEV_PACKET_SIZE);
+	reassembly_ptr->received[i / 8] |= 1 << (i % 8);
+	++reassembly_ptr->received_count;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (reassembly_ptr->delivered_count < reassembly_ptr->packet_count
+	       && m210_dev_reassembly_has(reassembly_ptr,
+					  reassembly_ptr->delivered_count + 1)) {
+		err = sink_ptr->write(sink_ptr->arg,
+				      (reassembly_ptr->data
+				       + (reassembly_ptr->delivered_count
+					  * M210_DEV_PACKET_SIZE)),
+				      M210_DEV_PACKET_SIZE);
+		if (err) {
+			goto out;
 		}
+		++reassembly_ptr->delivered_count;
+		if (stats_ptr) {
+			stats_ptr->bytes_written += M210_DEV_PACKET_SIZE;
+		}
+	}
+	if (stats_ptr) {
+		stats_ptr->write_time += m210_dev_elapsed_us(&start);
+	}
+out:
+	return err;
+}
 
-		if (!lost_count) {
-			if (fwrite(packet.data, sizeof(packet.data), 1,
-				   file) != 1) {
-				err = M210_ERR_SYS;
+/*
+  The journal of a download is a header followed by the packets in
+  the order they were received, exactly as the device sent them:
+
+  * 8 bytes: "M210JNL1"
+  * 2 bytes: packet count of the download, little-endian
+  * 2 bytes: reserved, zero
+  * N * 64 bytes: packets, a big-endian number and the data
+
+  Loads the packets of journal to the reassembly if the journal is
+  of a download of the same size. Otherwise, or if the journal is
+  empty, starts it anew. An incomplete packet at the end, left by an
+  interrupted write, is cut off. The journal is left positioned for
+  appending.
+*/
+static enum m210_err m210_dev_journal_load(FILE *const journal,
+					   struct m210_dev_reassembly *const reassembly_ptr,
+					   struct m210_dev_sink const *const sink_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint8_t header[M210_DEV_JOURNAL_HEADER_SIZE];
+	uint16_t packet_count;
+	long size = sizeof(header);
+
+	rewind(journal);
+
+	if (fread(header, sizeof(header), 1, journal) != 1) {
+		memset(header, 0, sizeof(header));
+	}
+	memcpy(&packet_count, header + 8, sizeof(packet_count));
+
+	if (!memcmp(header, M210_DEV_JOURNAL_MAGIC, 8)
+	    && le16toh(packet_count) == reassembly_ptr->packet_count) {
+		struct m210_dev_packet packet;
+
+		while (fread(&packet, sizeof(packet), 1, journal) == 1) {
+			packet.num = be16toh(packet.num);
+			err = m210_dev_reassembly_put(reassembly_ptr, &packet,
+						      sink_ptr);
+			if (err) {
 				goto out;
 			}
+			size += sizeof(packet);
+		}
+	} else {
+		memset(header, 0, sizeof(header));
+		memcpy(header, M210_DEV_JOURNAL_MAGIC, 8);
+		packet_count = htole16(reassembly_ptr->packet_count);
+		memcpy(header + 8, &packet_count, sizeof(packet_count));
+
+		rewind(journal);
+		if (fwrite(header, sizeof(header), 1, journal) != 1) {
+			err = M210_ERR_SYS;
+			goto out;
 		}
 	}
 
-	while (lost_count > 0) {
+	if (ferror(journal)
+	    || fflush(journal)
+	    || ftruncate(fileno(journal), size) == -1
+	    || fseek(journal, size, SEEK_SET) == -1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+out:
+	return err;
+}
+
+/* A resend request waiting for its reply. Requests are numbered in
+ * the order they are written, the device answers them in that
+ * order. */
+struct m210_dev_resend_request {
+	uint16_t num;
+	/* The first request of the packet still unanswered: a reply
+	 * might answer any request of it since, this one at the
+	 * earliest. */
+	uint32_t first_seq;
+	uint32_t seq; /* The latest request of the packet. */
+};
+
+/* Returns the index of the request of packet num in requests, or
+ * -1 if it is not there. */
+static int m210_dev_find_request(struct m210_dev_resend_request const *const requests,
+				 int const count, uint16_t const num)
+{
+	for (int i = 0; i < count; ++i) {
+		if (requests[i].num == num) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static enum m210_err m210_dev_request_resend(struct m210_dev *const dev_ptr,
+					     struct m210_dev_resend_request *const request_ptr,
+					     uint32_t *const seq_ptr)
+{
+	uint8_t resend_request[] = {0xb7, 0x00, 0x00};
+	enum m210_err err;
+
+	resend_request[1] = request_ptr->num >> 8;
+	resend_request[2] = request_ptr->num;
+	err = m210_dev_write(dev_ptr, resend_request, sizeof(resend_request));
+	if (err) {
+		return err;
+	}
+	++dev_ptr->stats.resends;
+	request_ptr->seq = (*seq_ptr)++;
+	return M210_ERR_OK;
+}
+
+/*
+  Requests the gaps of a download. Up to M210_DEV_RESEND_WINDOW
+  requests are kept in flight, so a lost packet costs one request
+  instead of a round trip. Replies are matched to the requests by
+  packet number, stale and duplicate ones match none and are dropped
+  by the reassembly.
+
+  The device answers in order, so a reply tells that the requests
+  written before the first request of its packet were lost, and they
+  are written again right away. A packet overtaken by the next one is
+  not taken for lost, and neither is a request written after that
+  first one, whichever request the reply answers. A request inferred
+  lost is not inferred lost again before a request written after it
+  has been answered, which bounds these requests by the packets.
+
+  If nothing arrives within the first byte deadline, every request
+  in flight is written again. Only these and the first request of a
+  packet count as attempts, a packet is requested
+  M210_DEV_MAX_RESEND_RETRIES times at most.
+*/
+static enum m210_err m210_dev_resend(struct m210_dev *const dev_ptr,
+				     struct m210_dev_reassembly *const reassembly_ptr,
+				     struct m210_dev_sink const *const sink_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_dev_resend_request in_flight[M210_DEV_RESEND_WINDOW];
+	int in_flight_count = 0;
+	uint32_t next_num = 1; /* Gaps before this are in flight. */
+	uint32_t seq = 0;
+	uint8_t *retries = NULL;
+
+	retries = m210_dev_alloc(dev_ptr, reassembly_ptr->packet_count, 1);
+	if (retries == NULL) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	while (1) {
 		struct m210_dev_packet packet;
+		struct m210_dev_resend_request answered;
+		int answeredi;
+
+		while (in_flight_count < M210_DEV_RESEND_WINDOW) {
+			struct m210_dev_resend_request *const request_ptr =
+				in_flight + in_flight_count;
+
+			while (next_num <= reassembly_ptr->packet_count
+			       && m210_dev_reassembly_has(reassembly_ptr,
+							  next_num)) {
+				++next_num;
+			}
+			if (next_num > reassembly_ptr->packet_count) {
+				break;
+			}
+
+			if (retries[next_num - 1]++ == M210_DEV_MAX_RESEND_RETRIES) {
+				err = M210_ERR_DEV_TIMEOUT;
+				goto out;
+			}
+
+			request_ptr->num = next_num++;
+			request_ptr->first_seq = seq;
+			err = m210_dev_request_resend(dev_ptr, request_ptr,
+						      &seq);
+			if (err) {
+				goto out;
+			}
+			++in_flight_count;
+		}
 
-		uint8_t resend_request[] = {0xb7, 0x00};
-		resend_request[1] = htobe16(lost_nums[0]);
+		if (in_flight_count == 0) {
+			/* No gaps left. */
+			break;
+		}
 
-		err = m210_dev_write(dev_ptr, resend_request,
-				     sizeof(resend_request));
+		err = m210_dev_read_packet(dev_ptr, &packet,
+					   dev_ptr->timeouts.first_byte);
+		if (err == M210_ERR_DEV_TIMEOUT) {
+			for (int i = 0; i < in_flight_count; ++i) {
+				uint16_t const num = in_flight[i].num;
+
+				if (retries[num - 1]++ == M210_DEV_MAX_RESEND_RETRIES) {
+					err = M210_ERR_DEV_TIMEOUT;
+					goto out;
+				}
+				err = m210_dev_request_resend(dev_ptr,
+							      in_flight + i,
+							      &seq);
+				if (err) {
+					goto out;
+				}
+			}
+			continue;
+		}
 		if (err) {
 			goto out;
 		}
 
-		err = m210_dev_read_packet(dev_ptr, &packet);
+		/* Whatever arrives is kept, even if it was not
+		 * requested. */
+		err = m210_dev_reassembly_put(reassembly_ptr, &packet,
+					      sink_ptr);
 		if (err) {
 			goto out;
 		}
 
-		if (packet.num == lost_nums[0]) {
-			lost_nums[0] = lost_nums[--lost_count];
-			if (fwrite(packet.data, sizeof(packet.data), 1,
-				   file) != 1) {
-				err = M210_ERR_SYS;
-				goto out;
+		answeredi = m210_dev_find_request(in_flight, in_flight_count,
+						  packet.num);
+		if (answeredi < 0) {
+			/* Stale, duplicate or not requested. */
+			continue;
+		}
+		answered = in_flight[answeredi];
+		--in_flight_count;
+		memmove(in_flight + answeredi, in_flight + answeredi + 1,
+			(in_flight_count - answeredi)
+			* sizeof(struct m210_dev_resend_request));
+
+		/* Requests written before the first request of the
+		 * answered packet, and not just by one, were lost. */
+		for (int i = 0; i < in_flight_count; ++i) {
+			if (in_flight[i].seq + 1 < answered.first_seq) {
+				err = m210_dev_request_resend(dev_ptr,
+							      in_flight + i,
+							      &seq);
+				if (err) {
+					goto out;
+				}
 			}
 		}
 	}
+out:
+	m210_dev_release(dev_ptr, retries);
+	return err;
+}
+
+/* Accepts the download and receives the packets the device sends
+ * on its own. */
+static enum m210_err m210_dev_receive(struct m210_dev *const dev_ptr,
+				      struct m210_dev_reassembly *const reassembly_ptr,
+				      struct m210_dev_sink const *const sink_ptr)
+{
+	enum m210_err err = m210_dev_accept_download(dev_ptr);
+	uint16_t max_num = 0;
+
+	if (err) {
+		goto out;
+	}
+
+	/* The device sends each packet once. Lost ones leave the
+	 * stream short, so it is over once the device goes quiet. */
+	for (int i = 0; i < reassembly_ptr->packet_count; ++i) {
+		struct m210_dev_packet packet;
+		int const timeout = (i == 0 ? dev_ptr->timeouts.first_byte
+				     : dev_ptr->timeouts.packet);
+
+		err = m210_dev_read_packet(dev_ptr, &packet, timeout);
+		if (err == M210_ERR_DEV_TIMEOUT) {
+			err = M210_ERR_OK;
+			break;
+		}
+		if (err) {
+			goto out;
+		}
+
+		/* Resent packets are behind by design, only this
+		 * stream tells whether packets overtake others. */
+		if (packet.num < max_num) {
+			++dev_ptr->stats.out_of_order;
+		} else {
+			max_num = packet.num;
+		}
+
+		err = m210_dev_reassembly_put(reassembly_ptr, &packet,
+					      sink_ptr);
+		if (err) {
+			goto out;
+		}
+	}
+out:
+	return err;
+}
+
+static enum m210_err m210_dev_download(struct m210_dev *const dev_ptr,
+				       struct m210_dev_reassembly *const reassembly_ptr,
+				       struct m210_dev_sink const *const sink_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct timespec start;
+
+	/* Resend requests are served only once the download has been
+	 * accepted, which makes the device send all packets, and
+	 * after the packets it sends on its own. So they are received
+	 * even when resuming, packets of the journal are dropped as
+	 * duplicates. */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	err = m210_dev_receive(dev_ptr, reassembly_ptr, sink_ptr);
+	dev_ptr->stats.receive_time += m210_dev_elapsed_us(&start);
+	if (err) {
+		goto out;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	err = m210_dev_resend(dev_ptr, reassembly_ptr, sink_ptr);
+	dev_ptr->stats.resend_time += m210_dev_elapsed_us(&start);
 out:
 	return err;
 }
 
+static enum m210_err m210_dev_write_file(void *const arg,
+					 uint8_t const *const data,
+					 size_t const size)
+{
+	FILE *const file = arg;
+
+	if (fwrite(data, size, 1, file) != 1) {
+		return M210_ERR_SYS;
+	}
+	return M210_ERR_OK;
+}
+
 enum m210_err m210_dev_download_notes(struct m210_dev *const dev_ptr, FILE *file)
+{
+	return m210_dev_resume_notes(dev_ptr, file, NULL);
+}
+
+enum m210_err m210_dev_resume_notes(struct m210_dev *const dev_ptr,
+				    FILE *const file, FILE *const journal)
+{
+	struct m210_dev_sink const sink = {NULL, m210_dev_write_file, file};
+	enum m210_err const err = m210_dev_resume_notes_to_sink(dev_ptr, &sink,
+								journal);
+	if (file) {
+		fflush(file);
+	}
+	return err;
+}
+
+enum m210_err m210_dev_download_notes_to_sink(struct m210_dev *const dev_ptr,
+					      struct m210_dev_sink const *const sink_ptr)
+{
+	return m210_dev_resume_notes_to_sink(dev_ptr, sink_ptr, NULL);
+}
+
+enum m210_err m210_dev_resume_notes_to_sink(struct m210_dev *const dev_ptr,
+					    struct m210_dev_sink const *const sink_ptr,
+					    FILE *const journal)
 {
 	enum m210_err err = M210_ERR_OK;
-	uint16_t *lost_nums = NULL;
+	struct m210_dev_reassembly reassembly;
 	uint16_t packet_count = 0;
 
+	memset(&reassembly, 0, sizeof(reassembly));
+	dev_ptr->arena_used = 0;
+
 	err = m210_dev_begin_download(dev_ptr, &packet_count);
 	if (err) {
 		goto out;
@@ -571,21 +1837,45 @@ enum m210_err m210_dev_download_notes(struct m210_dev *const dev_ptr, FILE *file
 		goto out;
 	}
 
-	lost_nums = calloc(packet_count, sizeof(uint16_t));
-	if (lost_nums == NULL) {
+	err = m210_dev_reassembly_init(dev_ptr, &reassembly, packet_count);
+	if (err) {
 		int const original_errno = errno;
 		m210_dev_reject_download(dev_ptr);
 		errno = original_errno;
-		err = M210_ERR_SYS;
 		goto out;
 	}
 
-	err = m210_dev_accept_download(dev_ptr);
-	if (err) {
-		goto out;
+	if (sink_ptr->begin) {
+		err = sink_ptr->begin(sink_ptr->arg,
+				      packet_count * M210_DEV_PACKET_SIZE);
+		if (err) {
+			int const original_errno = errno;
+			m210_dev_reject_download(dev_ptr);
+			errno = original_errno;
+			goto out;
+		}
 	}
 
-	err = m210_dev_download(dev_ptr, packet_count, lost_nums, file);
+	if (journal) {
+		err = m210_dev_journal_load(journal, &reassembly, sink_ptr);
+		if (err) {
+			int const original_errno = errno;
+			m210_dev_reject_download(dev_ptr);
+			errno = original_errno;
+			goto out;
+		}
+		reassembly.journal = journal;
+
+		if (reassembly.received_count == packet_count) {
+			/* Nothing is missing, the offer is declined
+			 * like that of an empty device. */
+			err = m210_dev_reject_download(dev_ptr);
+			goto out;
+		}
+	}
+	reassembly.stats = &dev_ptr->stats;
+
+	err = m210_dev_download(dev_ptr, &reassembly, sink_ptr);
 	if (err) {
 		goto out;
 	}
@@ -596,9 +1886,9 @@ enum m210_err m210_dev_download_notes(struct m210_dev *const dev_ptr, FILE *file
 	*/
 	err = m210_dev_accept_download(dev_ptr);
 out:
-	if (file) {
-		fflush(file);
+	if (reassembly.journal && fflush(reassembly.journal) && !err) {
+		err = M210_ERR_SYS;
 	}
-	free(lost_nums);
+	m210_dev_reassembly_free(dev_ptr, &reassembly);
 	return err;
 }
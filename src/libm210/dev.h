@@ -20,15 +20,82 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <time.h>
+
+#include <linux/limits.h> /* PATH_MAX */
 
 #include "err.h"
+#include "ring.h"
 
 #define M210_DEV_MODE_MOUSE  0x01
 #define M210_DEV_MODE_TABLET 0x02
 
+/* Bits of struct m210_dev_sample state. */
+#define M210_DEV_SAMPLE_TIP      0x01
+#define M210_DEV_SAMPLE_SW1      0x02
+#define M210_DEV_SAMPLE_SW2      0x04
+#define M210_DEV_SAMPLE_IN_RANGE 0x10
+
+#define M210_DEV_PACKET_SIZE 62      /* Bytes of memory per packet. */
 #define M210_DEV_MAX_MEMORY 4063232 /* Bytes. */
 
+#define M210_DEV_JOURNAL_SUFFIX ".journal"
+
+/* Bytes of arena which hold the state of any download: the packets,
+ * a bitmap of them and a retry count for each. */
+#define M210_DEV_ARENA_SIZE (M210_DEV_MAX_MEMORY + 8192 + 65536)
+
+#define M210_DEV_USB_INTERFACE_COUNT 2
+
+/* Defaults of struct m210_dev_timeouts. */
+#define M210_DEV_DEFAULT_FIRST_BYTE_TIMEOUT 100 /* Milliseconds. */
+#define M210_DEV_DEFAULT_PACKET_TIMEOUT 100     /* Milliseconds. */
+#define M210_DEV_DEFAULT_EMPTY_PROBES 2
+
+/* Bucket i of struct m210_dev_stats read_latencies counts reads
+ * which took less than 2**i microseconds, the last one the rest. */
+#define M210_DEV_STATS_LATENCY_BUCKETS 21
+
 typedef struct m210_dev *m210_dev;
+typedef struct m210_dev_monitor *m210_dev_monitor;
+
+struct m210_dev_timeouts {
+	/* How long to wait for the response to a request. */
+	int first_byte;
+	/* How long to wait for the next packet of a download. */
+	int packet;
+	/* How many unanswered packet count requests it takes to
+	 * decide that the device has no notes. Only the last one
+	 * waits the full first_byte timeout, the others adapt to how
+	 * fast the device has responded so far. */
+	int empty_probes;
+};
+
+/* What the device has been through since it was connected or the
+ * stats were last reset. Only the traffic of interface 0, requests
+ * and downloads, is counted, not pen reports. Times are in
+ * microseconds. */
+struct m210_dev_stats {
+	unsigned long requests;      /* Requests sent. */
+	unsigned long reads;         /* Reports received. */
+	unsigned long timeouts;      /* Reads which timed out. */
+	unsigned long begin_retries; /* Packet count requests sent again. */
+	unsigned long packets;       /* Download packets received. */
+	unsigned long duplicates;    /* ... of which dropped, being received
+				      * already or out of range. */
+	unsigned long out_of_order;  /* ... of which sent by the device
+				      * after a later one. */
+	unsigned long resends;       /* Lost packets asked for again. */
+	unsigned long long bytes_written; /* Bytes given to the sink. */
+	/* Time spent asking for the packet count, receiving the
+	 * packets the device sends on its own, asking for lost ones,
+	 * and in the sink during both of the latter. */
+	unsigned long long begin_time;
+	unsigned long long receive_time;
+	unsigned long long resend_time;
+	unsigned long long write_time;
+	unsigned long read_latencies[M210_DEV_STATS_LATENCY_BUCKETS];
+};
 
 struct m210_dev_info {
 	uint16_t firmware_version;
@@ -38,10 +105,137 @@ struct m210_dev_info {
 	uint32_t used_memory;
 };
 
+/* A pen position reported live in tablet mode. */
+struct m210_dev_sample {
+	struct timespec time; /* CLOCK_MONOTONIC, when it was read. */
+	uint16_t x;
+	uint16_t y;
+	uint16_t pressure;
+	uint8_t state;
+};
+
+/* An attached M210: its USB device and a hidraw device node for
+ * each of its interfaces. */
+struct m210_dev_node {
+	char usb_syspath[PATH_MAX];
+	char hidraw_paths[M210_DEV_USB_INTERFACE_COUNT][PATH_MAX];
+};
+
+struct m210_dev_list {
+	struct m210_dev_node *nodes;
+	size_t count;
+};
+
+/* Receives downloaded memory as it arrives. */
+struct m210_dev_sink {
+	/* Called once before any data with the total size in bytes,
+	 * can be NULL. */
+	enum m210_err (*begin)(void *arg, uint32_t size);
+	/* Called with consecutive pieces of memory, from the first
+	 * byte to the last. An error aborts the download. */
+	enum m210_err (*write)(void *arg, uint8_t const *data, size_t size);
+	void *arg;
+};
+
+/* How requests reach a device and reports come back from it. The
+ * default transport talks to hidraw device nodes. */
+struct m210_dev_transport {
+	/* Sends a request, a whole output report, to interface 0. */
+	enum m210_err (*write)(void *arg, uint8_t const *request,
+			       size_t size);
+	/* Waits at most timeout milliseconds, or forever if timeout
+	 * is negative, for a report of interface and reads at most
+	 * size bytes of it to report. *sizep is set to the number of
+	 * bytes read. Returns M210_ERR_DEV_TIMEOUT if nothing came
+	 * in time. Interface 1 may be read from another thread while
+	 * interface 0 is in use. */
+	enum m210_err (*read)(void *arg, int interface, void *report,
+			      size_t size, size_t *sizep, int timeout);
+	/* Called on disconnect, can be NULL. */
+	enum m210_err (*close)(void *arg);
+	void *arg;
+};
+
+/* Finds all attached devices. The list can be kept and connected
+ * to later without looking the devices up again. */
+enum m210_err m210_dev_list_find(struct m210_dev_list *listp);
+void m210_dev_list_free(struct m210_dev_list *listp);
+
+/* Watches devices being plugged in. m210_dev_monitor_receive()
+ * blocks until all interfaces of a device have appeared and returns
+ * the device. */
+enum m210_err m210_dev_monitor_new(m210_dev_monitor *monitorp);
+void m210_dev_monitor_free(m210_dev_monitor *monitorp);
+enum m210_err m210_dev_monitor_receive(m210_dev_monitor monitor,
+				       struct m210_dev_node *nodep);
+/* Tells the monitor about a device which is already there, found by
+ * m210_dev_list_find() after the monitor was created. If its add
+ * event is still to be received, it is not reported again. Once the
+ * device has been removed, it is reported like any other. */
+enum m210_err m210_dev_monitor_ignore(m210_dev_monitor monitor,
+				      struct m210_dev_node const *nodep);
+
+/* Connects to the first device found. */
 enum m210_err m210_dev_connect(m210_dev *devp);
+enum m210_err m210_dev_connect_node(m210_dev *devp,
+				    struct m210_dev_node const *nodep);
+/* Connects to a device behind transport. The transport is closed
+ * on disconnect, or right away if connecting fails. */
+enum m210_err m210_dev_connect_transport(m210_dev *devp,
+					 struct m210_dev_transport const *transportp);
 enum m210_err m210_dev_disconnect(m210_dev *devp);
+
+/* Records all traffic with the device to file from now on, in the
+ * format of m210_trace_record(). Not while a reader is running. */
+enum m210_err m210_dev_record(m210_dev dev, FILE *file);
+/* Lends dev arena_size bytes at arena for the state of downloads,
+ * so that they do not allocate memory; M210_DEV_ARENA_SIZE bytes
+ * are enough for any. Downloads whose state does not fit fall back
+ * to the heap. The arena must outlive dev, or be taken back by
+ * setting NULL, and must not be shared with another device. */
+void m210_dev_set_arena(m210_dev dev, void *arena, size_t arena_size);
+void m210_dev_get_timeouts(m210_dev dev, struct m210_dev_timeouts *timeoutsp);
+enum m210_err m210_dev_set_timeouts(m210_dev dev,
+				    struct m210_dev_timeouts const *timeoutsp);
+void m210_dev_get_stats(m210_dev dev, struct m210_dev_stats *statsp);
+void m210_dev_reset_stats(m210_dev dev);
 enum m210_err m210_dev_get_info(m210_dev dev, struct m210_dev_info *infop);
 enum m210_err m210_dev_download_notes(m210_dev dev, FILE *file);
+enum m210_err m210_dev_download_notes_to_sink(m210_dev dev,
+					      struct m210_dev_sink const *sink);
+
+/* Like the download functions above but record every packet
+ * received to journal, which must be open for reading and writing.
+ * If journal holds packets of a download of the same size, those
+ * are kept: the device still sends all packets, but only the ones
+ * missing from both are asked for again, and if the journal holds
+ * all of them, the device is not downloaded from at all. */
+enum m210_err m210_dev_resume_notes(m210_dev dev, FILE *file, FILE *journal);
+enum m210_err m210_dev_resume_notes_to_sink(m210_dev dev,
+					    struct m210_dev_sink const *sink,
+					    FILE *journal);
 enum m210_err m210_dev_delete_notes(m210_dev dev);
 
+/* Switches the device to M210_DEV_MODE_TABLET or
+ * M210_DEV_MODE_MOUSE. In tablet mode, the pen is reported live
+ * through m210_dev_read_sample(). */
+enum m210_err m210_dev_set_mode(m210_dev dev, uint8_t mode);
+
+/* Waits at most timeout milliseconds, or forever if timeout is
+ * negative, for the next pen report. */
+enum m210_err m210_dev_read_sample(m210_dev dev,
+				   struct m210_dev_sample *samplep,
+				   int timeout);
+
+/* Starts a thread which reads pen reports into ring, whose items
+ * are struct m210_dev_sample, so that a slow consumer does not
+ * delay the reads. Samples which do not fit are dropped and counted
+ * by the ring. A read error closes the ring with that error. Only
+ * interface 1 is read, commands can still be sent meanwhile. There
+ * is at most one reader per device. */
+enum m210_err m210_dev_start_reader(m210_dev dev, m210_ring ring);
+/* Waits for the reader to finish, which takes at most about a
+ * tenth of a second. Does nothing if there is no reader. */
+enum m210_err m210_dev_stop_reader(m210_dev dev);
+
 #endif /* DEV_H */
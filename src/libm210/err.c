@@ -16,7 +16,6 @@
  */
 
 #include <errno.h>
-#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -33,52 +32,34 @@ char const *m210_err_strerror(enum m210_err const err)
 		"response waiting timeouted",
 		"raw note has malformed head",
 		"raw note has malformed body",
-		"unexpected end-of-file"
+		"unexpected end-of-file",
+		"note index is malformed",
+		"trace is malformed",
+		"request differs from the trace",
+		"archive is malformed"
 	};
 	return err_strs[err];
 }
 
 extern char *program_invocation_name;
 
+/* Does not allocate memory, so that it works also when memory has
+ * run out. */
 enum m210_err m210_err_perror(enum m210_err const err, char const *const msg)
 {
-	enum m210_err result;
 	int const original_errno = errno;
 	char const *const m210_errstr = m210_err_strerror(err);
-	/* +2 == a colon and a blank */
-	size_t const progname_len = strlen(program_invocation_name) + 2;
-	/* +2 == a colon and a blank */
-	size_t const msg_len = msg == NULL ? 0 : strlen(msg) + 2;
-	size_t const m210_errstr_len = strlen(m210_errstr);
-
-	/* +1 == a terminating null byte. */
-	size_t const total_len = (progname_len + msg_len
-				  + m210_errstr_len + 1);
-	char *errstr;
-
-	errstr = (char *)calloc(total_len, sizeof(char));
-	if (errstr == NULL) {
-		result = M210_ERR_SYS;
-		goto out;
-	}
-
-	if (msg == NULL) {
-		snprintf(errstr, total_len, "%s: %s",
-			 program_invocation_name, m210_errstr);
-	} else {
-		snprintf(errstr, total_len, "%s: %s: %s",
-			 program_invocation_name, msg, m210_errstr);
-	}
+	char const *const separator = msg == NULL ? "" : ": ";
 
 	if (err == M210_ERR_SYS) {
-		errno = original_errno;
-		perror(errstr);
+		fprintf(stderr, "%s: %s%s%s: %s\n", program_invocation_name,
+			msg == NULL ? "" : msg, separator, m210_errstr,
+			strerror(original_errno));
 	} else {
-		fprintf(stderr, "%s\n", errstr);
+		fprintf(stderr, "%s: %s%s%s\n", program_invocation_name,
+			msg == NULL ? "" : msg, separator, m210_errstr);
 	}
+	errno = original_errno;
 
-	result = M210_ERR_OK;
-out:
-	free(errstr);
-	return result;
+	return M210_ERR_OK;
 }
@@ -27,7 +27,11 @@ enum m210_err {
 	M210_ERR_DEV_TIMEOUT,
 	M210_ERR_BAD_RAWNOTE_HEAD,
 	M210_ERR_BAD_RAWNOTE_BODY,
-	M210_ERR_UNEXPECTED_EOF
+	M210_ERR_UNEXPECTED_EOF,
+	M210_ERR_BAD_INDEX,
+	M210_ERR_BAD_TRACE,
+	M210_ERR_TRACE_MISMATCH,
+	M210_ERR_BAD_ARCHIVE
 };
 
 char const *m210_err_strerror(enum m210_err err);
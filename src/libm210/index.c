@@ -0,0 +1,376 @@
+/* libm210
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <endian.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+
+#include "index.h"
+#include "note.h"
+#include "rawnote.h"
+
+/*
+  Index file layout, all integers little-endian:
+
+  HEADER (32 bytes)
+    magic           8 bytes  "M210IDX3"
+    dump_size       8 bytes
+    dump_mtime      8 bytes  seconds since the epoch
+    dump_mtime_nsec 4 bytes  nanoseconds of dump_mtime
+    count           4 bytes
+  ENTRY * count (28 bytes each), ordered by dump
+    offset     8 bytes
+    dump       4 bytes  counted from 0 over concatenated dumps
+    bodyc      4 bytes
+    number     1 byte
+    state      1 byte
+    reserved   2 bytes
+    min_x, min_y, max_x, max_y  2 bytes each
+*/
+
+#define M210_INDEX_DECODE_CHUNK 1024
+
+/* Bytes of the smallest note there can be: a note record of an
+ * archive with a single empty stroke. A raw head alone takes more. */
+#define M210_INDEX_MIN_NOTE_SIZE 6
+
+/* Entries allocated at first when reading an index, more are
+ * allocated only as they are read. */
+#define M210_INDEX_READ_CHUNK 1024
+
+static char const M210_INDEX_MAGIC[8] = {'M', '2', '1', '0', 'I', 'D', 'X', '3'};
+
+struct m210_index_rawheader {
+	char magic[8];
+	uint64_t dump_size;
+	int64_t dump_mtime;
+	uint32_t dump_mtime_nsec;
+	uint32_t count;
+} __attribute__((packed));
+
+struct m210_index_rawentry {
+	uint64_t offset;
+	uint32_t dump;
+	uint32_t bodyc;
+	uint8_t number;
+	uint8_t state;
+	uint8_t reserved[2];
+	int16_t min_x;
+	int16_t min_y;
+	int16_t max_x;
+	int16_t max_y;
+} __attribute__((packed));
+
+static void m210_index_bound(struct m210_index_entry *const entryp,
+			     struct m210_note_span const *const spanp)
+{
+	entryp->min_x = INT16_MAX;
+	entryp->min_y = INT16_MAX;
+	entryp->max_x = INT16_MIN;
+	entryp->max_y = INT16_MIN;
+
+	for (ssize_t bodyi = 0; bodyi < spanp->bodyc;
+	     bodyi += M210_INDEX_DECODE_CHUNK) {
+		int16_t xs[M210_INDEX_DECODE_CHUNK];
+		int16_t ys[M210_INDEX_DECODE_CHUNK];
+		uint16_t pressures[M210_INDEX_DECODE_CHUNK];
+		size_t const count = (spanp->bodyc - bodyi
+				      < M210_INDEX_DECODE_CHUNK
+				      ? (size_t) (spanp->bodyc - bodyi)
+				      : M210_INDEX_DECODE_CHUNK);
+
+		m210_note_decode_bodies(xs, ys, pressures,
+					spanp->rawbodies + bodyi, count);
+		for (size_t i = 0; i < count; ++i) {
+			if (!pressures[i]) {
+				continue;
+			}
+			if (xs[i] < entryp->min_x) {
+				entryp->min_x = xs[i];
+			}
+			if (xs[i] > entryp->max_x) {
+				entryp->max_x = xs[i];
+			}
+			if (ys[i] < entryp->min_y) {
+				entryp->min_y = ys[i];
+			}
+			if (ys[i] > entryp->max_y) {
+				entryp->max_y = ys[i];
+			}
+		}
+	}
+}
+
+static enum m210_err m210_index_append(struct m210_index *const indexp,
+				       size_t *const capacityp,
+				       uint32_t const dump,
+				       struct m210_note_span const *const spanp)
+{
+	struct m210_index_entry *entryp;
+
+	if (indexp->count == *capacityp) {
+		size_t const capacity = *capacityp ? *capacityp * 2 : 64;
+		struct m210_index_entry *const entries = realloc(
+			indexp->entries,
+			capacity * sizeof(struct m210_index_entry));
+		if (entries == NULL) {
+			return M210_ERR_SYS;
+		}
+		indexp->entries = entries;
+		*capacityp = capacity;
+	}
+
+	entryp = indexp->entries + indexp->count++;
+	entryp->offset = spanp->offset;
+	entryp->dump = dump;
+	entryp->bodyc = spanp->bodyc;
+	entryp->number = spanp->number;
+	entryp->state = spanp->state;
+	m210_index_bound(entryp, spanp);
+
+	return M210_ERR_OK;
+}
+
+enum m210_err m210_index_build(struct m210_index *const indexp,
+			       int const dump_fd)
+{
+	enum m210_err err = M210_ERR_OK;
+	m210_note_map map = NULL;
+	struct stat st;
+	size_t capacity = 0;
+	uint32_t dump = 0;
+
+	memset(indexp, 0, sizeof(struct m210_index));
+
+	if (fstat(dump_fd, &st) == -1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	indexp->dump_size = st.st_size;
+	indexp->dump_mtime = st.st_mtim.tv_sec;
+	indexp->dump_mtime_nsec = st.st_mtim.tv_nsec;
+
+	err = m210_note_map_open(&map, dump_fd);
+	if (err) {
+		goto out;
+	}
+
+	while (!m210_note_map_eof(map)) {
+		struct m210_note_span span;
+
+		err = m210_note_map_read(map, &span);
+		if (err) {
+			goto out;
+		}
+
+		if (span.number == 0) {
+			/* End of one dump, the next one might follow. */
+			++dump;
+			continue;
+		}
+
+		err = m210_index_append(indexp, &capacity, dump, &span);
+		if (err) {
+			goto out;
+		}
+	}
+out:
+	if (map) {
+		enum m210_err const close_err = m210_note_map_close(&map);
+		if (!err) {
+			err = close_err;
+		}
+	}
+	if (err) {
+		m210_index_free(indexp);
+	}
+	return err;
+}
+
+enum m210_err m210_index_read(struct m210_index *const indexp,
+			      FILE *const file)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_index_rawheader rawheader;
+	size_t count;
+	size_t capacity = 0;
+
+	memset(indexp, 0, sizeof(struct m210_index));
+
+	if (fread(&rawheader, sizeof(rawheader), 1, file) != 1) {
+		err = ferror(file) ? M210_ERR_SYS : M210_ERR_BAD_INDEX;
+		goto out;
+	}
+
+	if (memcmp(rawheader.magic, M210_INDEX_MAGIC,
+		   sizeof(M210_INDEX_MAGIC))) {
+		err = M210_ERR_BAD_INDEX;
+		goto out;
+	}
+
+	indexp->dump_size = le64toh(rawheader.dump_size);
+	indexp->dump_mtime = le64toh(rawheader.dump_mtime);
+	indexp->dump_mtime_nsec = le32toh(rawheader.dump_mtime_nsec);
+	count = le32toh(rawheader.count);
+
+	/* A count of more notes than the dump could hold is
+	 * corrupt. */
+	if (indexp->dump_mtime_nsec >= 1000000000
+	    || count > indexp->dump_size / M210_INDEX_MIN_NOTE_SIZE) {
+		err = M210_ERR_BAD_INDEX;
+		goto out;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		struct m210_index_rawentry rawentry;
+		struct m210_index_entry *entryp;
+
+		/* Grown as entries are read, so that a count the file
+		 * does not hold allocates no more than the file does. */
+		if (i == capacity) {
+			size_t const new_capacity = (capacity
+						     ? capacity * 2
+						     : M210_INDEX_READ_CHUNK);
+			struct m210_index_entry *const entries = realloc(
+				indexp->entries,
+				new_capacity * sizeof(struct m210_index_entry));
+			if (entries == NULL) {
+				err = M210_ERR_SYS;
+				goto out;
+			}
+			indexp->entries = entries;
+			capacity = new_capacity;
+		}
+		entryp = indexp->entries + i;
+
+		if (fread(&rawentry, sizeof(rawentry), 1, file) != 1) {
+			err = ferror(file) ? M210_ERR_SYS : M210_ERR_BAD_INDEX;
+			goto out;
+		}
+		/* Lookups rely on entries being ordered by dump. */
+		if (i && le32toh(rawentry.dump) < indexp->entries[i - 1].dump) {
+			err = M210_ERR_BAD_INDEX;
+			goto out;
+		}
+		indexp->count = i + 1;
+		entryp->offset = le64toh(rawentry.offset);
+		entryp->dump = le32toh(rawentry.dump);
+		entryp->bodyc = le32toh(rawentry.bodyc);
+		entryp->number = rawentry.number;
+		entryp->state = rawentry.state;
+		entryp->min_x = le16toh(rawentry.min_x);
+		entryp->min_y = le16toh(rawentry.min_y);
+		entryp->max_x = le16toh(rawentry.max_x);
+		entryp->max_y = le16toh(rawentry.max_y);
+	}
+out:
+	if (err) {
+		m210_index_free(indexp);
+	}
+	return err;
+}
+
+enum m210_err m210_index_write(struct m210_index const *const indexp,
+			       FILE *const file)
+{
+	struct m210_index_rawheader rawheader;
+
+	memcpy(rawheader.magic, M210_INDEX_MAGIC, sizeof(M210_INDEX_MAGIC));
+	rawheader.dump_size = htole64(indexp->dump_size);
+	rawheader.dump_mtime = htole64(indexp->dump_mtime);
+	rawheader.dump_mtime_nsec = htole32(indexp->dump_mtime_nsec);
+	rawheader.count = htole32(indexp->count);
+
+	if (fwrite(&rawheader, sizeof(rawheader), 1, file) != 1) {
+		return M210_ERR_SYS;
+	}
+
+	for (size_t i = 0; i < indexp->count; ++i) {
+		struct m210_index_rawentry rawentry;
+		struct m210_index_entry const *const entryp = indexp->entries + i;
+
+		memset(&rawentry, 0, sizeof(rawentry));
+		rawentry.offset = htole64(entryp->offset);
+		rawentry.dump = htole32(entryp->dump);
+		rawentry.bodyc = htole32(entryp->bodyc);
+		rawentry.number = entryp->number;
+		rawentry.state = entryp->state;
+		rawentry.min_x = htole16(entryp->min_x);
+		rawentry.min_y = htole16(entryp->min_y);
+		rawentry.max_x = htole16(entryp->max_x);
+		rawentry.max_y = htole16(entryp->max_y);
+
+		if (fwrite(&rawentry, sizeof(rawentry), 1, file) != 1) {
+			return M210_ERR_SYS;
+		}
+	}
+
+	if (fflush(file)) {
+		return M210_ERR_SYS;
+	}
+	return M210_ERR_OK;
+}
+
+void m210_index_free(struct m210_index *const indexp)
+{
+	free(indexp->entries);
+	indexp->entries = NULL;
+	indexp->count = 0;
+}
+
+int m210_index_is_current(struct m210_index const *const indexp,
+			  int const dump_fd)
+{
+	struct stat st;
+
+	if (fstat(dump_fd, &st) == -1) {
+		return 0;
+	}
+	return ((uint64_t) st.st_size == indexp->dump_size
+		&& (int64_t) st.st_mtim.tv_sec == indexp->dump_mtime
+		&& (uint32_t) st.st_mtim.tv_nsec == indexp->dump_mtime_nsec);
+}
+
+struct m210_index_entry const *m210_index_find(struct m210_index const *const indexp,
+					       uint32_t const dump,
+					       uint8_t const number)
+{
+	size_t low = 0;
+	size_t high = indexp->count;
+
+	/* Entries are ordered by dump: find the first one of dump,
+	 * then the note among the entries of that dump. */
+	while (low < high) {
+		size_t const middle = low + (high - low) / 2;
+
+		if (indexp->entries[middle].dump < dump) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	for (size_t i = low;
+	     i < indexp->count && indexp->entries[i].dump == dump; ++i) {
+		if (indexp->entries[i].number == number) {
+			return indexp->entries + i;
+		}
+	}
+	return NULL;
+}
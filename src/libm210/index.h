@@ -0,0 +1,67 @@
+/* libm210
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "err.h"
+
+/* Appended to the name of a dump to get the name of its index. */
+#define M210_INDEX_SUFFIX ".idx"
+
+struct m210_index_entry {
+	uint64_t offset; /* Of the raw head in the dump, or in the raw
+			  * dump an archive holds. */
+	uint32_t dump; /* Counted from 0 over concatenated dumps. */
+	uint32_t bodyc;
+	uint8_t number;
+	uint8_t state;
+	/* Bounding box of pen-down points, min_x > max_x if none. */
+	int16_t min_x;
+	int16_t min_y;
+	int16_t max_x;
+	int16_t max_y;
+};
+
+/* Directory of a dump: one entry per note in the order they are in
+ * the dump, over all dumps of a concatenated archive. */
+struct m210_index {
+	uint64_t dump_size;
+	int64_t dump_mtime; /* Seconds since the epoch. */
+	uint32_t dump_mtime_nsec;
+	size_t count;
+	struct m210_index_entry *entries;
+};
+
+enum m210_err m210_index_build(struct m210_index *indexp, int dump_fd);
+enum m210_err m210_index_read(struct m210_index *indexp, FILE *file);
+enum m210_err m210_index_write(struct m210_index const *indexp, FILE *file);
+void m210_index_free(struct m210_index *indexp);
+
+/* Returns non-zero if the index was built from the dump as it is
+ * now. */
+int m210_index_is_current(struct m210_index const *indexp, int dump_fd);
+
+/* Returns the entry of note number in dump, or NULL. */
+struct m210_index_entry const *m210_index_find(struct m210_index const *indexp,
+					       uint32_t dump,
+					       uint8_t number);
+
+#endif /* INDEX_H */
@@ -16,12 +16,32 @@
  */
 
 #include <endian.h>
+#include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "archive.h"
+#include "dev.h"
 #include "note.h"
 #include "rawnote.h"
 
+struct m210_note_map {
+	uint8_t const *data;
+	size_t size;
+	size_t pos;  /* Offset of the next raw head. */
+	size_t base; /* Offset of the current dump, next_pos is relative to it. */
+	int is_mmapped;
+	int is_owned; /* Data was allocated for the map. */
+};
+
+/* Block size of reading streams to memory. */
+#define M210_NOTE_STREAM_CHUNK 65536
+
 static inline int is_penup(struct m210_rawnote_body const *const bodyp)
 {
 	return memcmp(bodyp, &M210_RAWNOTE_BODY_PENUP,
@@ -100,21 +120,328 @@ enum m210_err m210_note_read_body(struct m210_note_body *bodyp, FILE *file)
 		goto out;
 	}
 
+	m210_note_decode_body(bodyp, &rawbody);
+
+	err = M210_ERR_OK;
+out:
+	return err;
+}
+
+void m210_note_decode_body(struct m210_note_body *const bodyp,
+			   struct m210_rawnote_body const *const rawbodyp)
+{
 	/* Map byte arrays to coordinate values. */
-	memcpy(&(bodyp->x), rawbody.x, 2);
-	memcpy(&(bodyp->y), rawbody.y, 2);
+	memcpy(&(bodyp->x), rawbodyp->x, 2);
+	memcpy(&(bodyp->y), rawbodyp->y, 2);
 
 	/* Mind the byte order. */
 	bodyp->x = le16toh(bodyp->x);
 	bodyp->y = le16toh(bodyp->y);
 
-	if (is_penup(&rawbody)) {
+	if (is_penup(rawbodyp)) {
 		bodyp->pressure = 0;
 	} else {
 		bodyp->pressure = 1;
 	}
+}
 
-	err = M210_ERR_OK;
+/* Replaces an archive the map holds with the raw dump it decodes
+ * to. Raw dumps are left alone. */
+static enum m210_err m210_note_map_unarchive(struct m210_note_map *const map)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint8_t *dump;
+	size_t size;
+
+	if (!m210_archive_check(map->data, map->size)) {
+		goto out;
+	}
+
+	err = m210_archive_decode(&dump, &size, map->data, map->size);
+	if (err) {
+		goto out;
+	}
+
+	if (map->is_mmapped) {
+		munmap((void *) map->data, map->size);
+	} else if (map->is_owned) {
+		free((void *) map->data);
+	}
+	map->data = dump;
+	map->size = size;
+	map->is_mmapped = 0;
+	map->is_owned = 1;
+out:
+	return err;
+}
+
+enum m210_err m210_note_map_open(struct m210_note_map **const mapp,
+				 int const fd)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_note_map *map = NULL;
+	struct stat st;
+
+	map = calloc(1, sizeof(struct m210_note_map));
+	if (map == NULL) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	if (fstat(fd, &st) == -1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	if ((uintmax_t) st.st_size > SIZE_MAX) {
+		errno = EFBIG;
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	map->size = st.st_size;
+
+	/* mmap() refuses zero-length mappings, an empty dump is
+	 * handled by reporting EOF on the first read. */
+	if (map->size == 0) {
+		goto out;
+	}
+
+	map->data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map->data == MAP_FAILED) {
+		map->data = NULL;
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	map->is_mmapped = 1;
+
+	/* Notes are walked front to back, a hint is all that
+	 * matters, hence the result is not checked. */
+	madvise((void *) map->data, map->size, MADV_SEQUENTIAL);
+
+	err = m210_note_map_unarchive(map);
 out:
+	if (err) {
+		m210_note_map_close(&map);
+	}
+	*mapp = map;
+	return err;
+}
+
+enum m210_err m210_note_map_open_stream(struct m210_note_map **const mapp,
+					FILE *const file)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_note_map *map = NULL;
+	uint8_t *data = NULL;
+	size_t capacity = 0;
+	size_t size = 0;
+
+	map = calloc(1, sizeof(struct m210_note_map));
+	if (map == NULL) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	while (1) {
+		size_t count;
+
+		if (capacity - size < M210_NOTE_STREAM_CHUNK) {
+			size_t const new_capacity = (capacity
+						     ? capacity * 2
+						     : M210_NOTE_STREAM_CHUNK);
+			uint8_t *const new_data = realloc(data, new_capacity);
+
+			if (new_data == NULL) {
+				err = M210_ERR_SYS;
+				goto out;
+			}
+			data = new_data;
+			capacity = new_capacity;
+		}
+
+		count = fread(data + size, 1, capacity - size, file);
+		size += count;
+		if (count == 0) {
+			break;
+		}
+	}
+	if (ferror(file)) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	map->data = data;
+	map->size = size;
+	map->is_owned = 1;
+	data = NULL;
+
+	err = m210_note_map_unarchive(map);
+out:
+	free(data);
+	if (err) {
+		m210_note_map_close(&map);
+	}
+	*mapp = map;
 	return err;
 }
+
+enum m210_err m210_note_map_open_buffer(struct m210_note_map **const mapp,
+					uint8_t const *const data,
+					size_t const size)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_note_map *const map = calloc(1,
+						 sizeof(struct m210_note_map));
+
+	if (map == NULL) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	map->data = data;
+	map->size = size;
+out:
+	*mapp = map;
+	return err;
+}
+
+void m210_note_map_set_size(struct m210_note_map *const map,
+			    size_t const size)
+{
+	map->size = size;
+}
+
+enum m210_err m210_note_map_close(struct m210_note_map **const mapp)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_note_map *const map = *mapp;
+
+	if (map == NULL) {
+		goto out;
+	}
+
+	if (map->is_mmapped && munmap((void *) map->data, map->size) == -1) {
+		err = M210_ERR_SYS;
+	}
+	if (map->is_owned) {
+		free((void *) map->data);
+	}
+	free(map);
+	*mapp = NULL;
+out:
+	return err;
+}
+
+/*
+  Walks the next_pos chain in place. Every dump ends with an empty
+  head followed by zero-padding up to the packet boundary. The span
+  of that head has number 0, exactly like m210_note_read_head()
+  reports. If the file is a concatenation of dumps, the walk
+  continues from the next packet boundary on the following call;
+  m210_note_map_eof() tells whether there is anything left.
+*/
+enum m210_err m210_note_map_read(struct m210_note_map *const map,
+				 struct m210_note_span *const spanp)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_rawnote_head const *rawheadp;
+	size_t bodies_pos;
+	size_t next_pos;
+
+	if (map->size - map->pos < sizeof(struct m210_rawnote_head)) {
+		err = M210_ERR_UNEXPECTED_EOF;
+		goto out;
+	}
+
+	rawheadp = (struct m210_rawnote_head const *) (map->data + map->pos);
+	bodies_pos = map->pos + sizeof(struct m210_rawnote_head);
+
+	spanp->offset = map->pos;
+
+	if (!memcmp(rawheadp, &M210_RAWNOTE_HEAD_LAST,
+		    sizeof(struct m210_rawnote_head))) {
+		size_t const dump_size = bodies_pos - map->base;
+		size_t const padding = ((M210_DEV_PACKET_SIZE
+					 - dump_size % M210_DEV_PACKET_SIZE)
+					% M210_DEV_PACKET_SIZE);
+
+		spanp->number = 0;
+		spanp->state = rawheadp->state;
+		spanp->bodyc = 0;
+		spanp->rawbodies = NULL;
+
+		if (map->size - bodies_pos < padding) {
+			map->base = map->size;
+		} else {
+			map->base = bodies_pos + padding;
+		}
+		map->pos = map->base;
+		goto out;
+	}
+
+	next_pos = map->base + le24toh32(rawheadp->next_pos);
+	if (next_pos < bodies_pos) {
+		err = M210_ERR_BAD_RAWNOTE_HEAD;
+		goto out;
+	}
+
+	if (next_pos > map->size) {
+		/* Bodies are cut off. */
+		err = M210_ERR_UNEXPECTED_EOF;
+		goto out;
+	}
+
+	/* The data section of a note consists of exactly N bodies. */
+	spanp->number = rawheadp->number;
+	spanp->state = rawheadp->state;
+	spanp->bodyc = ((next_pos - bodies_pos)
+			/ sizeof(struct m210_rawnote_body));
+	spanp->rawbodies = (struct m210_rawnote_body const *) (map->data
+							       + bodies_pos);
+
+	map->pos = next_pos;
+out:
+	return err;
+}
+
+enum m210_err m210_note_map_read_at(struct m210_note_map *const map,
+				    uint64_t const offset, size_t const bodyc,
+				    struct m210_note_span *const spanp)
+{
+	struct m210_rawnote_head const *rawheadp;
+	size_t const bodies_size = bodyc * sizeof(struct m210_rawnote_body);
+
+	if (offset > map->size
+	    || map->size - offset < sizeof(struct m210_rawnote_head)
+	    || bodyc > SIZE_MAX / sizeof(struct m210_rawnote_body)
+	    || (map->size - offset - sizeof(struct m210_rawnote_head)
+		< bodies_size)) {
+		return M210_ERR_UNEXPECTED_EOF;
+	}
+
+	rawheadp = (struct m210_rawnote_head const *) (map->data + offset);
+	if (!memcmp(rawheadp, &M210_RAWNOTE_HEAD_LAST,
+		    sizeof(struct m210_rawnote_head))) {
+		return M210_ERR_BAD_RAWNOTE_HEAD;
+	}
+
+	spanp->offset = offset;
+	spanp->number = rawheadp->number;
+	spanp->state = rawheadp->state;
+	spanp->bodyc = bodyc;
+	spanp->rawbodies = (struct m210_rawnote_body const *) (
+		map->data + offset + sizeof(struct m210_rawnote_head));
+
+	return M210_ERR_OK;
+}
+
+int m210_note_map_eof(struct m210_note_map *const map)
+{
+	return map->pos >= map->size;
+}
+
+uint8_t const *m210_note_map_get_data(struct m210_note_map *const map,
+				      size_t *const sizep)
+{
+	*sizep = map->size;
+	return map->data;
+}
@@ -20,9 +20,12 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 #include "err.h"
 
+struct m210_rawnote_body;
+
 struct m210_note_body {
 	int16_t x;
 	int16_t y;
@@ -34,7 +37,83 @@ struct m210_note_head {
 	ssize_t bodyc;
 };
 
+/* A note as it lies in a memory-mapped dump: rawbodies points
+ * straight into the mapping and stays valid until the map is
+ * closed. */
+struct m210_note_span {
+	off_t offset;
+	uint8_t number;
+	uint8_t state;
+	ssize_t bodyc;
+	struct m210_rawnote_body const *rawbodies;
+};
+
+typedef struct m210_note_map *m210_note_map;
+
 enum m210_err m210_note_read_head(struct m210_note_head *headp, FILE *file);
 enum m210_err m210_note_read_body(struct m210_note_body *bodyp, FILE *file);
 
+void m210_note_decode_body(struct m210_note_body *bodyp,
+			   struct m210_rawnote_body const *rawbodyp);
+
+/* Decodes count raw bodies at once into separate coordinate and
+ * pressure arrays. Uses SIMD instructions when the CPU has them. */
+void m210_note_decode_bodies(int16_t *xs, int16_t *ys, uint16_t *pressures,
+			     struct m210_rawnote_body const *rawbodies,
+			     size_t count);
+
+enum m210_note_decoder {
+	M210_NOTE_DECODER_AUTO,
+	M210_NOTE_DECODER_SCALAR,
+	M210_NOTE_DECODER_SSE2,
+	M210_NOTE_DECODER_AVX2
+};
+
+/* Like m210_note_decode_bodies() but through the given kernel, the
+ * bodies a vector kernel leaves over go through the scalar one.
+ * Returns -1 without decoding anything if the kernel is not
+ * available on this CPU. For checking the kernels against each
+ * other. */
+int m210_note_decode_bodies_with(enum m210_note_decoder decoder,
+				 int16_t *xs, int16_t *ys, uint16_t *pressures,
+				 struct m210_rawnote_body const *rawbodies,
+				 size_t count);
+
+/* Drops pen-down points of decoded bodies in place so that every
+ * stroke stays within tolerance device units of the original
+ * polyline (Ramer-Douglas-Peucker). Pen-ups, and the first and the
+ * last point of each stroke are kept. *countp is updated to the
+ * number of bodies left. */
+enum m210_err m210_note_simplify(int16_t *xs, int16_t *ys,
+				 uint16_t *pressures, size_t *countp,
+				 double tolerance);
+
+/* Maps the dump of fd to memory. An archive is decoded to memory
+ * instead, and walked like the raw dump it holds. */
+enum m210_err m210_note_map_open(m210_note_map *mapp, int fd);
+/* Reads all of file, a raw dump or an archive, to memory and walks
+ * that. For pipes and other streams which cannot be mapped. */
+enum m210_err m210_note_map_open_stream(m210_note_map *mapp, FILE *file);
+/* Walks a dump which is already in memory. The buffer is borrowed
+ * and must outlive the map. While the buffer is being filled, the
+ * map can be told about the new size: reads which run past the
+ * current size fail with M210_ERR_UNEXPECTED_EOF without consuming
+ * anything, and can be retried once there is more data. */
+enum m210_err m210_note_map_open_buffer(m210_note_map *mapp,
+					uint8_t const *data, size_t size);
+void m210_note_map_set_size(m210_note_map map, size_t size);
+enum m210_err m210_note_map_close(m210_note_map *mapp);
+enum m210_err m210_note_map_read(m210_note_map map,
+				 struct m210_note_span *spanp);
+/* Reads the note whose head is at offset and which has bodyc bodies,
+ * as an index has them, without moving where m210_note_map_read
+ * reads next. */
+enum m210_err m210_note_map_read_at(m210_note_map map, uint64_t offset,
+				    size_t bodyc,
+				    struct m210_note_span *spanp);
+int m210_note_map_eof(m210_note_map map);
+/* Returns the whole raw dump the map walks, the decoded one if it
+ * was opened from an archive, and sets *sizep to its size. */
+uint8_t const *m210_note_map_get_data(m210_note_map map, size_t *sizep);
+
 #endif /* NOTE_H */
@@ -0,0 +1,260 @@
+/* libm210
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "ring.h"
+
+/* Indices written by different threads are kept on cache lines of
+ * their own, so that the producer and the consumer do not keep
+ * stealing the same line from each other. */
+#define M210_RING_CACHE_LINE 64
+
+/*
+  head and tail run freely and wrap around at 2^32, the slot of an
+  index is index & mask. The ring is empty when head == tail and
+  full when tail - head == capacity.
+
+  A consumer going to sleep raises waiting and sleeps on the futex
+  word wakeups. The producer bumps wakeups and wakes the consumer
+  only if waiting is raised, so pushes to a ring nobody sleeps on
+  cost no system calls.
+*/
+struct m210_ring {
+	uint8_t *items;
+	size_t item_size;
+	uint32_t mask;
+
+	/* Written by the consumer. */
+	uint32_t head __attribute__((aligned(M210_RING_CACHE_LINE)));
+	uint32_t waiting;
+	uint64_t popped;
+
+	/* Written by the producer. */
+	uint32_t tail __attribute__((aligned(M210_RING_CACHE_LINE)));
+	uint32_t wakeups;
+	uint32_t closed;
+	enum m210_err close_err;
+	uint64_t pushed;
+	uint64_t overflows;
+};
+
+enum m210_err m210_ring_new(struct m210_ring **const ring_ptr_ptr,
+			    size_t const item_size,
+			    uint32_t const capacity)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_ring *ring_ptr = NULL;
+	uint32_t size = 1;
+
+	if (item_size == 0 || capacity == 0 || capacity > (UINT32_C(1) << 31)) {
+		errno = EINVAL;
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	while (size < capacity) {
+		size <<= 1;
+	}
+
+	if (posix_memalign((void **) &ring_ptr, M210_RING_CACHE_LINE,
+			   sizeof(struct m210_ring))) {
+		ring_ptr = NULL;
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	memset(ring_ptr, 0, sizeof(struct m210_ring));
+
+	ring_ptr->items = calloc(size, item_size);
+	if (ring_ptr->items == NULL) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	ring_ptr->item_size = item_size;
+	ring_ptr->mask = size - 1;
+out:
+	if (err) {
+		free(ring_ptr);
+		ring_ptr = NULL;
+	}
+	*ring_ptr_ptr = ring_ptr;
+	return err;
+}
+
+void m210_ring_free(struct m210_ring **const ring_ptr_ptr)
+{
+	struct m210_ring *const ring_ptr = *ring_ptr_ptr;
+
+	if (ring_ptr == NULL) {
+		return;
+	}
+	free(ring_ptr->items);
+	free(ring_ptr);
+	*ring_ptr_ptr = NULL;
+}
+
+static void m210_ring_wake(struct m210_ring *const ring_ptr)
+{
+	/* Orders the store which published something before the
+	 * load of waiting, the consumer does the same the other way
+	 * around: either it sees the news or we see it waiting. */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring_ptr->waiting, __ATOMIC_RELAXED)) {
+		__atomic_add_fetch(&ring_ptr->wakeups, 1, __ATOMIC_SEQ_CST);
+		syscall(SYS_futex, &ring_ptr->wakeups, FUTEX_WAKE_PRIVATE,
+			1, NULL, NULL, 0);
+	}
+}
+
+int m210_ring_push(struct m210_ring *const ring_ptr, void const *const item)
+{
+	uint32_t const tail = ring_ptr->tail;
+	uint32_t const head = __atomic_load_n(&ring_ptr->head,
+					      __ATOMIC_ACQUIRE);
+
+	if (tail - head > ring_ptr->mask) {
+		__atomic_add_fetch(&ring_ptr->overflows, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	memcpy(ring_ptr->items + (tail & ring_ptr->mask) * ring_ptr->item_size,
+	       item, ring_ptr->item_size);
+	__atomic_store_n(&ring_ptr->tail, tail + 1, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&ring_ptr->pushed, 1, __ATOMIC_RELAXED);
+
+	m210_ring_wake(ring_ptr);
+	return 1;
+}
+
+void m210_ring_close(struct m210_ring *const ring_ptr,
+		     enum m210_err const err)
+{
+	ring_ptr->close_err = err;
+	__atomic_store_n(&ring_ptr->closed, 1, __ATOMIC_RELEASE);
+	m210_ring_wake(ring_ptr);
+}
+
+int m210_ring_pop(struct m210_ring *const ring_ptr, void *const item)
+{
+	uint32_t const head = ring_ptr->head;
+	uint32_t const tail = __atomic_load_n(&ring_ptr->tail,
+					      __ATOMIC_ACQUIRE);
+
+	if (head == tail) {
+		return 0;
+	}
+
+	memcpy(item, ring_ptr->items + (head & ring_ptr->mask) * ring_ptr->item_size,
+	       ring_ptr->item_size);
+	__atomic_store_n(&ring_ptr->head, head + 1, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&ring_ptr->popped, 1, __ATOMIC_RELAXED);
+	return 1;
+}
+
+enum m210_err m210_ring_wait(struct m210_ring *const ring_ptr,
+			     void *const item, int const timeout)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct timespec deadline;
+
+	if (timeout >= 0) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout / 1000;
+		deadline.tv_nsec += (timeout % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_nsec -= 1000000000L;
+			++deadline.tv_sec;
+		}
+	}
+
+	while (1) {
+		struct timespec remaining;
+		struct timespec *remaining_ptr = NULL;
+		uint32_t wakeups;
+
+		if (m210_ring_pop(ring_ptr, item)) {
+			goto out;
+		}
+
+		if (__atomic_load_n(&ring_ptr->closed, __ATOMIC_ACQUIRE)) {
+			/* Items pushed before closing are visible
+			 * now, even if the pop above missed them. */
+			if (!m210_ring_pop(ring_ptr, item)) {
+				err = ring_ptr->close_err;
+			}
+			goto out;
+		}
+
+		if (timeout >= 0) {
+			struct timespec now;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+			remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+			if (remaining.tv_nsec < 0) {
+				remaining.tv_nsec += 1000000000L;
+				--remaining.tv_sec;
+			}
+			if (remaining.tv_sec < 0) {
+				err = M210_ERR_DEV_TIMEOUT;
+				goto out;
+			}
+			remaining_ptr = &remaining;
+		}
+
+		__atomic_store_n(&ring_ptr->waiting, 1, __ATOMIC_RELAXED);
+		wakeups = __atomic_load_n(&ring_ptr->wakeups, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		/* Anything pushed or closed from now on bumps wakeups
+		 * and makes the futex wait return at once. */
+		if (__atomic_load_n(&ring_ptr->tail, __ATOMIC_RELAXED)
+		    == ring_ptr->head
+		    && !__atomic_load_n(&ring_ptr->closed, __ATOMIC_RELAXED)
+		    && syscall(SYS_futex, &ring_ptr->wakeups,
+			       FUTEX_WAIT_PRIVATE, wakeups, remaining_ptr,
+			       NULL, 0) == -1
+		    && errno != EAGAIN && errno != EINTR
+		    && errno != ETIMEDOUT) {
+			__atomic_store_n(&ring_ptr->waiting, 0,
+					 __ATOMIC_RELAXED);
+			err = M210_ERR_SYS;
+			goto out;
+		}
+		__atomic_store_n(&ring_ptr->waiting, 0, __ATOMIC_RELAXED);
+	}
+out:
+	return err;
+}
+
+void m210_ring_get_counters(struct m210_ring *const ring_ptr,
+			    struct m210_ring_counters *const counters_ptr)
+{
+	counters_ptr->pushed = __atomic_load_n(&ring_ptr->pushed,
+					       __ATOMIC_RELAXED);
+	counters_ptr->popped = __atomic_load_n(&ring_ptr->popped,
+					       __ATOMIC_RELAXED);
+	counters_ptr->overflows = __atomic_load_n(&ring_ptr->overflows,
+						  __ATOMIC_RELAXED);
+}
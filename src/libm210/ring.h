@@ -0,0 +1,64 @@
+/* libm210
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "err.h"
+
+/* A fixed-size queue of fixed-size items between exactly one
+ * producer thread and one consumer thread. Neither side ever takes
+ * a lock: the producer is never blocked by a slow consumer, items
+ * which do not fit are dropped and counted instead. */
+typedef struct m210_ring *m210_ring;
+
+struct m210_ring_counters {
+	uint64_t pushed;    /* Items queued. */
+	uint64_t popped;    /* Items taken out. */
+	uint64_t overflows; /* Items dropped because the ring was full. */
+};
+
+/* Capacity is rounded up to the next power of two. */
+enum m210_err m210_ring_new(m210_ring *ringp, size_t item_size,
+			    uint32_t capacity);
+void m210_ring_free(m210_ring *ringp);
+
+/* Producer side. Returns 0 if the ring was full and the item was
+ * dropped, 1 otherwise. */
+int m210_ring_push(m210_ring ring, void const *item);
+
+/* Producer side. Tells the consumer that nothing more is coming,
+ * err is returned by m210_ring_wait() once the ring is empty. */
+void m210_ring_close(m210_ring ring, enum m210_err err);
+
+/* Consumer side. Returns 1 and copies the oldest item to item if
+ * there is one, 0 otherwise. */
+int m210_ring_pop(m210_ring ring, void *item);
+
+/* Consumer side. Waits at most timeout milliseconds, or forever if
+ * timeout is negative, for an item. Wakes up as soon as the
+ * producer pushes one. Returns M210_ERR_DEV_TIMEOUT on timeout. */
+enum m210_err m210_ring_wait(m210_ring ring, void *item, int timeout);
+
+/* Can be called from any thread. */
+void m210_ring_get_counters(m210_ring ring,
+			    struct m210_ring_counters *countersp);
+
+#endif /* RING_H */
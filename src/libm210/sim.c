@@ -0,0 +1,408 @@
+/* libm210
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sim.h"
+
+#define M210_SIM_REPORT_SIZE 64
+
+/* Made up, the version request just has to be answered. */
+#define M210_SIM_FIRMWARE_VERSION 0x0100
+#define M210_SIM_ANALOG_VERSION 0x0100
+#define M210_SIM_PAD_VERSION 0x0100
+
+/* Room for reports beyond a full upload stream: answers to other
+ * requests and resent packets. */
+#define M210_SIM_QUEUE_SLACK 64
+
+enum m210_sim_state {
+	M210_SIM_IDLE,
+	M210_SIM_OFFERED, /* Packet count sent, waiting for ACK. */
+	M210_SIM_SENDING  /* Upload accepted, resends are served. */
+};
+
+enum m210_sim_report_kind {
+	M210_SIM_REPORT_VERSION,
+	M210_SIM_REPORT_PACKET_COUNT,
+	M210_SIM_REPORT_PACKET
+};
+
+/* A report waiting to be read. */
+struct m210_sim_report {
+	struct timespec due;
+	enum m210_sim_report_kind kind;
+	uint16_t num; /* Of a packet. */
+};
+
+struct m210_sim {
+	uint8_t *memory;
+	uint16_t packet_count;
+	struct m210_sim_params params;
+	uint64_t random_state;
+	enum m210_sim_state state;
+	uint8_t mode;
+
+	/* Reports in the order they are read. */
+	struct m210_sim_report *queue;
+	size_t queue_capacity;
+	size_t queue_head;
+	size_t queue_count;
+	/* When the last report queued goes out, the next one can go
+	 * an interval later at the earliest. */
+	struct timespec last_due;
+
+	struct m210_sim_counters counters;
+};
+
+static void m210_sim_add_us(struct timespec *const time_ptr, long const us)
+{
+	time_ptr->tv_sec += us / 1000000;
+	time_ptr->tv_nsec += (us % 1000000) * 1000;
+	if (time_ptr->tv_nsec >= 1000000000) {
+		time_ptr->tv_nsec -= 1000000000;
+		++time_ptr->tv_sec;
+	}
+}
+
+static int m210_sim_is_before(struct timespec const *const a_ptr,
+			      struct timespec const *const b_ptr)
+{
+	return (a_ptr->tv_sec < b_ptr->tv_sec
+		|| (a_ptr->tv_sec == b_ptr->tv_sec
+		    && a_ptr->tv_nsec < b_ptr->tv_nsec));
+}
+
+static void m210_sim_sleep_until(struct timespec const *const time_ptr)
+{
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, time_ptr,
+			       NULL) == EINTR) {
+	}
+}
+
+static int m210_sim_chance(struct m210_sim *const sim_ptr,
+			   double const probability)
+{
+	/* xorshift64*. Faults are decided for every packet of
+	 * requests which repeat with a fixed stride, rand_r() was
+	 * seen to lose the same packet over and over. */
+	uint64_t x = sim_ptr->random_state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	sim_ptr->random_state = x;
+	return ((x * UINT64_C(2685821657736338717)) >> 11) * 0x1.0p-53 < probability;
+}
+
+static struct m210_sim_report *m210_sim_queue_at(struct m210_sim *const sim_ptr,
+						 size_t const i)
+{
+	return &sim_ptr->queue[(sim_ptr->queue_head + i)
+			       % sim_ptr->queue_capacity];
+}
+
+/* Schedules a report to go out latency after now, or an interval
+ * after the previous one if that is later. */
+static void m210_sim_queue(struct m210_sim *const sim_ptr,
+			   enum m210_sim_report_kind const kind,
+			   uint16_t const num)
+{
+	struct timespec due;
+	struct m210_sim_report *report_ptr;
+
+	clock_gettime(CLOCK_MONOTONIC, &due);
+	m210_sim_add_us(&due, sim_ptr->params.latency);
+	m210_sim_add_us(&sim_ptr->last_due, sim_ptr->params.interval);
+	if (m210_sim_is_before(&sim_ptr->last_due, &due)) {
+		sim_ptr->last_due = due;
+	}
+
+	if (kind == M210_SIM_REPORT_PACKET) {
+		/* A lost packet takes its time on the wire all the
+		 * same. */
+		++sim_ptr->counters.packets;
+		if (m210_sim_chance(sim_ptr, sim_ptr->params.loss)) {
+			++sim_ptr->counters.lost;
+			return;
+		}
+	}
+
+	if (sim_ptr->queue_count == sim_ptr->queue_capacity) {
+		/* The host is not reading, a real device would
+		 * give up on the report too. */
+		return;
+	}
+	report_ptr = m210_sim_queue_at(sim_ptr, sim_ptr->queue_count++);
+	report_ptr->due = sim_ptr->last_due;
+	report_ptr->kind = kind;
+	report_ptr->num = num;
+
+	if (kind == M210_SIM_REPORT_PACKET && sim_ptr->queue_count > 1
+	    && m210_sim_chance(sim_ptr, sim_ptr->params.reorder)) {
+		struct m210_sim_report *const previous_ptr =
+			m210_sim_queue_at(sim_ptr, sim_ptr->queue_count - 2);
+
+		if (previous_ptr->kind == M210_SIM_REPORT_PACKET) {
+			report_ptr->num = previous_ptr->num;
+			previous_ptr->num = num;
+			++sim_ptr->counters.reordered;
+		}
+	}
+}
+
+static void m210_sim_clear_queue(struct m210_sim *const sim_ptr)
+{
+	sim_ptr->queue_head = 0;
+	sim_ptr->queue_count = 0;
+}
+
+static enum m210_err m210_sim_write(void *const arg,
+				    uint8_t const *const request,
+				    size_t const request_size)
+{
+	struct m210_sim *const sim_ptr = arg;
+	uint8_t const *const bytes = request + 3;
+	size_t bytes_size;
+
+	/* Framed like m210_dev_write() does. */
+	if (request_size < 4 || request[1] != 0x02
+	    || request[2] > request_size - 3) {
+		errno = EINVAL;
+		return M210_ERR_SYS;
+	}
+	bytes_size = request[2];
+	++sim_ptr->counters.requests;
+
+	switch (bytes[0]) {
+	case 0x95:
+		m210_sim_queue(sim_ptr, M210_SIM_REPORT_VERSION, 0);
+		break;
+	case 0xb5:
+		/* An empty device does not answer at all. */
+		if (sim_ptr->packet_count) {
+			m210_sim_queue(sim_ptr, M210_SIM_REPORT_PACKET_COUNT, 0);
+			sim_ptr->state = M210_SIM_OFFERED;
+		}
+		break;
+	case 0xb6:
+		if (sim_ptr->state == M210_SIM_OFFERED) {
+			for (uint32_t num = 1; num <= sim_ptr->packet_count;
+			     ++num) {
+				m210_sim_queue(sim_ptr, M210_SIM_REPORT_PACKET,
+					       num);
+			}
+			sim_ptr->state = M210_SIM_SENDING;
+		} else {
+			/* The final ACK of an upload. */
+			sim_ptr->state = M210_SIM_IDLE;
+		}
+		break;
+	case 0xb7:
+		if (bytes_size >= 3 && sim_ptr->state == M210_SIM_SENDING) {
+			uint16_t const num = (bytes[1] << 8) | bytes[2];
+
+			++sim_ptr->counters.resends;
+			if (num >= 1 && num <= sim_ptr->packet_count) {
+				m210_sim_queue(sim_ptr, M210_SIM_REPORT_PACKET,
+					       num);
+			}
+		} else if (bytes_size == 1) {
+			m210_sim_clear_queue(sim_ptr);
+			sim_ptr->state = M210_SIM_IDLE;
+		}
+		break;
+	case 0xb0:
+		sim_ptr->packet_count = 0;
+		break;
+	case 0x80:
+		/* Operation mode: 0x80 0xb5 LED mode. */
+		if (bytes_size >= 4 && bytes[1] == 0xb5) {
+			sim_ptr->mode = bytes[3];
+		}
+		break;
+	default:
+		break;
+	}
+	return M210_ERR_OK;
+}
+
+static void m210_sim_fill(struct m210_sim const *const sim_ptr,
+			  struct m210_sim_report const *const report_ptr,
+			  uint8_t *const report)
+{
+	memset(report, 0, M210_SIM_REPORT_SIZE);
+
+	switch (report_ptr->kind) {
+	case M210_SIM_REPORT_VERSION:
+		report[0] = 0x80;
+		report[1] = 0xa9;
+		report[2] = 0x28;
+		report[3] = M210_SIM_FIRMWARE_VERSION >> 8;
+		report[4] = M210_SIM_FIRMWARE_VERSION & 0xff;
+		report[5] = M210_SIM_ANALOG_VERSION >> 8;
+		report[6] = M210_SIM_ANALOG_VERSION & 0xff;
+		report[7] = M210_SIM_PAD_VERSION >> 8;
+		report[8] = M210_SIM_PAD_VERSION & 0xff;
+		report[9] = 0x0e;
+		report[10] = sim_ptr->mode;
+		break;
+	case M210_SIM_REPORT_PACKET_COUNT:
+		memset(report, 0xaa, 5);
+		report[5] = sim_ptr->packet_count >> 8;
+		report[6] = sim_ptr->packet_count & 0xff;
+		report[7] = 0x55;
+		report[8] = 0x55;
+		break;
+	case M210_SIM_REPORT_PACKET:
+		report[0] = report_ptr->num >> 8;
+		report[1] = report_ptr->num & 0xff;
+		memcpy(report + 2, (sim_ptr->memory
+				    + (report_ptr->num - 1) * M210_DEV_PACKET_SIZE),
+		       M210_DEV_PACKET_SIZE);
+		break;
+	}
+}
+
+static enum m210_err m210_sim_read(void *const arg,
+				   int const interface,
+				   void *const report,
+				   size_t const report_size,
+				   size_t *const size_ptr,
+				   int const timeout)
+{
+	struct m210_sim *const sim_ptr = arg;
+	struct m210_sim_report const *report_ptr = NULL;
+	struct timespec deadline;
+	uint8_t full_report[M210_SIM_REPORT_SIZE];
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	m210_sim_add_us(&deadline, timeout * 1000L);
+
+	if (interface == 0 && sim_ptr->queue_count) {
+		report_ptr = m210_sim_queue_at(sim_ptr, 0);
+		if (timeout >= 0
+		    && m210_sim_is_before(&deadline, &report_ptr->due)) {
+			report_ptr = NULL;
+		}
+	}
+
+	if (report_ptr == NULL) {
+		/* Nothing is coming in time, the wait is as long as
+		 * with a real device. */
+		while (timeout < 0) {
+			m210_sim_sleep_until(&deadline);
+			m210_sim_add_us(&deadline, 1000000);
+		}
+		m210_sim_sleep_until(&deadline);
+		return M210_ERR_DEV_TIMEOUT;
+	}
+
+	m210_sim_sleep_until(&report_ptr->due);
+	m210_sim_fill(sim_ptr, report_ptr, full_report);
+	sim_ptr->queue_head = (sim_ptr->queue_head + 1) % sim_ptr->queue_capacity;
+	--sim_ptr->queue_count;
+
+	*size_ptr = (report_size < M210_SIM_REPORT_SIZE
+		     ? report_size : M210_SIM_REPORT_SIZE);
+	memcpy(report, full_report, *size_ptr);
+	return M210_ERR_OK;
+}
+
+enum m210_err m210_sim_new(struct m210_sim **const sim_ptr_ptr,
+			   uint8_t const *const memory,
+			   size_t const size,
+			   struct m210_sim_params const *const params_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_sim *sim_ptr = NULL;
+
+	/* The packet count is sent in two bytes. */
+	if (size > UINT16_MAX * M210_DEV_PACKET_SIZE) {
+		errno = EINVAL;
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	sim_ptr = calloc(1, sizeof(struct m210_sim));
+	if (sim_ptr == NULL) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	sim_ptr->params = *params_ptr;
+	/* The state must not be zero. */
+	sim_ptr->random_state = params_ptr->seed + UINT64_C(0x9e3779b97f4a7c15);
+	sim_ptr->state = M210_SIM_IDLE;
+	sim_ptr->mode = M210_DEV_MODE_MOUSE;
+	sim_ptr->packet_count = ((size + M210_DEV_PACKET_SIZE - 1)
+				 / M210_DEV_PACKET_SIZE);
+	clock_gettime(CLOCK_MONOTONIC, &sim_ptr->last_due);
+
+	/* The last packet is padded with zeros. */
+	sim_ptr->memory = calloc(sim_ptr->packet_count + 1,
+				 M210_DEV_PACKET_SIZE);
+	if (sim_ptr->memory == NULL) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	memcpy(sim_ptr->memory, memory, size);
+
+	sim_ptr->queue_capacity = sim_ptr->packet_count + M210_SIM_QUEUE_SLACK;
+	sim_ptr->queue = malloc(sim_ptr->queue_capacity
+				* sizeof(struct m210_sim_report));
+	if (sim_ptr->queue == NULL) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+out:
+	if (err) {
+		m210_sim_free(&sim_ptr);
+	}
+	*sim_ptr_ptr = sim_ptr;
+	return err;
+}
+
+void m210_sim_free(struct m210_sim **const sim_ptr_ptr)
+{
+	struct m210_sim *const sim_ptr = *sim_ptr_ptr;
+
+	if (sim_ptr == NULL) {
+		return;
+	}
+	free(sim_ptr->queue);
+	free(sim_ptr->memory);
+	free(sim_ptr);
+	*sim_ptr_ptr = NULL;
+}
+
+void m210_sim_get_transport(struct m210_sim *const sim_ptr,
+			    struct m210_dev_transport *const transport_ptr)
+{
+	transport_ptr->write = m210_sim_write;
+	transport_ptr->read = m210_sim_read;
+	transport_ptr->close = NULL;
+	transport_ptr->arg = sim_ptr;
+}
+
+void m210_sim_get_counters(struct m210_sim *const sim_ptr,
+			   struct m210_sim_counters *const counters_ptr)
+{
+	*counters_ptr = sim_ptr->counters;
+}
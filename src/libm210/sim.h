@@ -0,0 +1,70 @@
+/* libm210
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dev.h"
+#include "err.h"
+
+/* An M210 simulated in process: it answers the version (0x95),
+ * upload (0xb5), ACK (0xb6), NACK and resend (0xb7) and erase
+ * (0xb0) commands from a memory image, at the pace and with the
+ * faults asked for. It never reports the pen. */
+typedef struct m210_sim *m210_sim;
+
+struct m210_sim_params {
+	/* Microseconds from a request to the first report it is
+	 * answered with. */
+	long latency;
+	/* Microseconds between consecutive reports, a real device
+	 * sends one per USB frame. */
+	long interval;
+	/* Probability of a packet being lost, from 0 to 1. Resent
+	 * packets are lost just as likely. */
+	double loss;
+	/* Probability of a packet being sent after the one which
+	 * follows it. */
+	double reorder;
+	unsigned int seed;
+};
+
+struct m210_sim_counters {
+	uint64_t requests;  /* Commands received. */
+	uint64_t packets;   /* Packets sent, resent ones included. */
+	uint64_t lost;      /* Packets lost on the way. */
+	uint64_t reordered; /* Packets swapped with the next one. */
+	uint64_t resends;   /* Packets requested again. */
+};
+
+/* Copies size bytes of memory, at most 65535 packets, to be the
+ * notes of the simulated device. A raw dump as downloaded will do. */
+enum m210_err m210_sim_new(m210_sim *simp, uint8_t const *memory,
+			   size_t size, struct m210_sim_params const *paramsp);
+void m210_sim_free(m210_sim *simp);
+
+/* Fills a transport for m210_dev_connect_transport(). Closing it
+ * leaves the simulator alone, it has to outlive the connection. */
+void m210_sim_get_transport(m210_sim sim,
+			    struct m210_dev_transport *transportp);
+
+void m210_sim_get_counters(m210_sim sim, struct m210_sim_counters *countersp);
+
+#endif /* SIM_H */
@@ -0,0 +1,151 @@
+/* libm210
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "note.h"
+
+struct m210_simplify_range {
+	size_t first;
+	size_t last;
+};
+
+/* Squared distance from point p to the segment from a to b. */
+static double segment_distance2(double const px, double const py,
+				double const ax, double const ay,
+				double const bx, double const by)
+{
+	double const dx = bx - ax;
+	double const dy = by - ay;
+	double const len2 = dx * dx + dy * dy;
+	double t = 0;
+	double ex;
+	double ey;
+
+	if (len2 > 0) {
+		t = ((px - ax) * dx + (py - ay) * dy) / len2;
+		if (t < 0) {
+			t = 0;
+		} else if (t > 1) {
+			t = 1;
+		}
+	}
+	ex = ax + t * dx - px;
+	ey = ay + t * dy - py;
+	return ex * ex + ey * ey;
+}
+
+/*
+  Ramer-Douglas-Peucker over xs[first..last], iteratively with an
+  explicit stack so that long strokes cannot exhaust the call stack.
+  Marks the points to keep in keeps.
+*/
+static void simplify_run(int16_t const *const xs, int16_t const *const ys,
+			 uint8_t *const keeps,
+			 struct m210_simplify_range *const stack,
+			 size_t const first, size_t const last,
+			 double const tolerance2)
+{
+	size_t depth = 0;
+
+	keeps[first] = 1;
+	keeps[last] = 1;
+	stack[depth].first = first;
+	stack[depth].last = last;
+	++depth;
+
+	while (depth) {
+		struct m210_simplify_range const range = stack[--depth];
+		double max_distance2 = 0;
+		size_t max_i = range.first;
+
+		for (size_t i = range.first + 1; i < range.last; ++i) {
+			double const distance2 = segment_distance2(
+				xs[i], ys[i],
+				xs[range.first], ys[range.first],
+				xs[range.last], ys[range.last]);
+			if (distance2 > max_distance2) {
+				max_distance2 = distance2;
+				max_i = i;
+			}
+		}
+
+		if (max_distance2 > tolerance2) {
+			keeps[max_i] = 1;
+			stack[depth].first = range.first;
+			stack[depth].last = max_i;
+			++depth;
+			stack[depth].first = max_i;
+			stack[depth].last = range.last;
+			++depth;
+		}
+	}
+}
+
+enum m210_err m210_note_simplify(int16_t *const xs, int16_t *const ys,
+				 uint16_t *const pressures,
+				 size_t *const countp, double const tolerance)
+{
+	enum m210_err err = M210_ERR_OK;
+	size_t const count = *countp;
+	uint8_t *keeps = NULL;
+	struct m210_simplify_range *stack = NULL;
+	size_t run_first = 0;
+	size_t kept = 0;
+
+	if (count < 3) {
+		goto out;
+	}
+
+	keeps = calloc(count, sizeof(uint8_t));
+	/* Ranges on the stack never overlap, so there are fewer of
+	 * them than there are points. */
+	stack = malloc(count * sizeof(struct m210_simplify_range));
+	if (keeps == NULL || stack == NULL) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	/* Pen-ups separate the runs and are always kept. */
+	for (size_t i = 0; i <= count; ++i) {
+		if (i < count && pressures[i]) {
+			continue;
+		}
+		if (i > run_first) {
+			simplify_run(xs, ys, keeps, stack, run_first, i - 1,
+				     tolerance * tolerance);
+		}
+		if (i < count) {
+			keeps[i] = 1;
+		}
+		run_first = i + 1;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		if (keeps[i]) {
+			xs[kept] = xs[i];
+			ys[kept] = ys[i];
+			pressures[kept] = pressures[i];
+			++kept;
+		}
+	}
+	*countp = kept;
+out:
+	free(stack);
+	free(keeps);
+	return err;
+}
@@ -0,0 +1,332 @@
+/* libm210
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "svg.h"
+
+/* The longest points are "-32768,-32768 " and "l-65535-65535". */
+#define M210_SVG_MAX_POINT_SIZE 16
+
+static char const SVG_HEAD[] =
+	"<?xml version=\"1.0\"?>\n"
+	"<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" \"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">\n"
+	"<svg width=\"210mm\" height=\"297mm\" viewBox=\"-7000 0 14000 20000\" xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\">\n";
+static char const SVG_TAIL[] = "</svg>\n";
+static char const SVG_POLYLINE_BEGIN[] =
+	"<polyline stroke-width=\"20\" stroke=\"black\" fill=\"none\" points=\"";
+static char const SVG_POLYLINE_END[] = "\" />\n";
+static char const SVG_GROUP_BEGIN[] =
+	"<g stroke-width=\"20\" stroke=\"black\" fill=\"none\">\n";
+static char const SVG_GROUP_END[] = "</g>\n";
+static char const SVG_PATH_BEGIN[] = "<path d=\"M";
+static char const SVG_PATH_END[] = "\"/>\n";
+
+static char const DIGIT_PAIRS[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+struct m210_svg {
+	FILE *file;
+	enum m210_svg_style style;
+	int has_path;
+	int has_delta;  /* Path style: the lineto command is written. */
+	int last_x;     /* Path style: the previous point. */
+	int last_y;
+	size_t len;
+	char buf[M210_SVG_BUFFER_SIZE];
+};
+
+/*
+  Formats value, |value| < 1000000, in decimal like printf("%d") does
+  and returns a pointer past the last character. The sign and the
+  length are computed without branching, digits are emitted two at a
+  time from the end.
+*/
+static inline char *format_int(char *p, int const value)
+{
+	unsigned int u = value < 0 ? -(unsigned int) value : (unsigned int) value;
+	size_t const len = (1 + (u >= 10) + (u >= 100) + (u >= 1000)
+			    + (u >= 10000) + (u >= 100000));
+	char *end;
+
+	*p = '-';
+	p += value < 0;
+	end = p + len;
+
+	while (u >= 100) {
+		end -= 2;
+		memcpy(end, DIGIT_PAIRS + (u % 100) * 2, 2);
+		u /= 100;
+	}
+	if (u >= 10) {
+		memcpy(end - 2, DIGIT_PAIRS + u * 2, 2);
+	} else {
+		*(end - 1) = '0' + u;
+	}
+	return p + len;
+}
+
+static enum m210_err m210_svg_flush(struct m210_svg *const svg)
+{
+	enum m210_err err = M210_ERR_OK;
+
+	if (svg->len && fwrite(svg->buf, svg->len, 1, svg->file) != 1) {
+		err = M210_ERR_SYS;
+	}
+	svg->len = 0;
+	return err;
+}
+
+static enum m210_err m210_svg_put(struct m210_svg *const svg,
+				  char const *const str, size_t const len)
+{
+	enum m210_err err = M210_ERR_OK;
+
+	if (sizeof(svg->buf) - svg->len < len) {
+		err = m210_svg_flush(svg);
+		if (err) {
+			goto out;
+		}
+	}
+	memcpy(svg->buf + svg->len, str, len);
+	svg->len += len;
+out:
+	return err;
+}
+
+enum m210_err m210_svg_new(struct m210_svg **const svgp)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_svg *const svg = calloc(1, sizeof(struct m210_svg));
+
+	if (svg == NULL) {
+		err = M210_ERR_SYS;
+	}
+	*svgp = svg;
+	return err;
+}
+
+void m210_svg_free(struct m210_svg **const svgp)
+{
+	free(*svgp);
+	*svgp = NULL;
+}
+
+/* Writes a number of path data. A separator is needed only
+ * between two numbers, and a minus sign is a separator itself. */
+static inline char *format_path_int(char *p, int const value,
+				    int const needs_separator)
+{
+	*p = ' ';
+	p += needs_separator && value >= 0;
+	return format_int(p, value);
+}
+
+void m210_svg_set_style(struct m210_svg *const svg,
+			enum m210_svg_style const style)
+{
+	svg->style = style;
+}
+
+enum m210_err m210_svg_begin(struct m210_svg *const svg, FILE *const file)
+{
+	enum m210_err err;
+
+	svg->file = file;
+	svg->has_path = 0;
+	svg->len = 0;
+
+	err = m210_svg_put(svg, SVG_HEAD, sizeof(SVG_HEAD) - 1);
+	if (!err && svg->style == M210_SVG_STYLE_PATH) {
+		/* Paths share their attributes through a group. */
+		err = m210_svg_put(svg, SVG_GROUP_BEGIN,
+				   sizeof(SVG_GROUP_BEGIN) - 1);
+	}
+	return err;
+}
+
+static enum m210_err write_polyline_bodies(struct m210_svg *const svg,
+					   int16_t const *const xs,
+					   int16_t const *const ys,
+					   uint16_t const *const pressures,
+					   size_t const count)
+{
+	enum m210_err err = M210_ERR_OK;
+
+	for (size_t i = 0; i < count; ++i) {
+		if (pressures[i]) {
+			char *p;
+
+			if (!svg->has_path) {
+				err = m210_svg_put(svg, SVG_POLYLINE_BEGIN,
+						   sizeof(SVG_POLYLINE_BEGIN) - 1);
+				if (err) {
+					goto out;
+				}
+				svg->has_path = 1;
+			}
+
+			if (sizeof(svg->buf) - svg->len < M210_SVG_MAX_POINT_SIZE) {
+				err = m210_svg_flush(svg);
+				if (err) {
+					goto out;
+				}
+			}
+			p = svg->buf + svg->len;
+			p = format_int(p, xs[i]);
+			*p++ = ',';
+			p = format_int(p, ys[i]);
+			*p++ = ' ';
+			svg->len = p - svg->buf;
+		} else {
+			/* Pen-up closes the polyline, even an unopened
+			 * one. */
+			err = m210_svg_put(svg, SVG_POLYLINE_END,
+					   sizeof(SVG_POLYLINE_END) - 1);
+			if (err) {
+				goto out;
+			}
+			svg->has_path = 0;
+		}
+	}
+out:
+	return err;
+}
+
+static enum m210_err write_path_bodies(struct m210_svg *const svg,
+				       int16_t const *const xs,
+				       int16_t const *const ys,
+				       uint16_t const *const pressures,
+				       size_t const count)
+{
+	enum m210_err err = M210_ERR_OK;
+
+	for (size_t i = 0; i < count; ++i) {
+		char *p;
+
+		if (!pressures[i]) {
+			if (svg->has_path) {
+				err = m210_svg_put(svg, SVG_PATH_END,
+						   sizeof(SVG_PATH_END) - 1);
+				if (err) {
+					goto out;
+				}
+				svg->has_path = 0;
+			}
+			continue;
+		}
+
+		if (!svg->has_path) {
+			err = m210_svg_put(svg, SVG_PATH_BEGIN,
+					   sizeof(SVG_PATH_BEGIN) - 1);
+			if (err) {
+				goto out;
+			}
+		}
+
+		if (sizeof(svg->buf) - svg->len < M210_SVG_MAX_POINT_SIZE) {
+			err = m210_svg_flush(svg);
+			if (err) {
+				goto out;
+			}
+		}
+		p = svg->buf + svg->len;
+
+		if (!svg->has_path) {
+			/* Absolute moveto starts the stroke. */
+			p = format_path_int(p, xs[i], 0);
+			p = format_path_int(p, ys[i], 1);
+			svg->has_path = 1;
+			svg->has_delta = 0;
+		} else {
+			/* Relative lineto for the rest, the command
+			 * letter is implicit after the first pair. */
+			if (!svg->has_delta) {
+				*p++ = 'l';
+			}
+			p = format_path_int(p, xs[i] - svg->last_x,
+					    svg->has_delta);
+			p = format_path_int(p, ys[i] - svg->last_y, 1);
+			svg->has_delta = 1;
+		}
+		svg->last_x = xs[i];
+		svg->last_y = ys[i];
+		svg->len = p - svg->buf;
+	}
+out:
+	return err;
+}
+
+enum m210_err m210_svg_write_bodies(struct m210_svg *const svg,
+				    int16_t const *const xs,
+				    int16_t const *const ys,
+				    uint16_t const *const pressures,
+				    size_t const count)
+{
+	if (svg->style == M210_SVG_STYLE_PATH) {
+		return write_path_bodies(svg, xs, ys, pressures, count);
+	}
+	return write_polyline_bodies(svg, xs, ys, pressures, count);
+}
+
+enum m210_err m210_svg_end(struct m210_svg *const svg)
+{
+	enum m210_err err = M210_ERR_OK;
+
+	if (svg->style == M210_SVG_STYLE_PATH) {
+		/* Unlike polylines, an unfinished path is closed to
+		 * keep the markup well-formed. */
+		if (svg->has_path) {
+			err = m210_svg_put(svg, SVG_PATH_END,
+					   sizeof(SVG_PATH_END) - 1);
+			svg->has_path = 0;
+		}
+		if (!err) {
+			err = m210_svg_put(svg, SVG_GROUP_END,
+					   sizeof(SVG_GROUP_END) - 1);
+		}
+		if (err) {
+			goto out;
+		}
+	}
+
+	err = m210_svg_put(svg, SVG_TAIL, sizeof(SVG_TAIL) - 1);
+	if (err) {
+		goto out;
+	}
+	err = m210_svg_flush(svg);
+out:
+	svg->file = NULL;
+	return err;
+}
+
+enum m210_err m210_svg_abort(struct m210_svg *const svg)
+{
+	enum m210_err const err = m210_svg_flush(svg);
+	svg->file = NULL;
+	return err;
+}
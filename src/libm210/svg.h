@@ -0,0 +1,67 @@
+/* libm210
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SVG_H
+#define SVG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "err.h"
+
+#define M210_SVG_BUFFER_SIZE 65536 /* Bytes. */
+
+typedef struct m210_svg *m210_svg;
+
+enum m210_svg_style {
+	/* A <polyline> of absolute points per stroke. */
+	M210_SVG_STYLE_POLYLINE,
+	/* A <path> of relative moves per stroke, several times
+	 * smaller. */
+	M210_SVG_STYLE_PATH
+};
+
+/*
+  A writer renders decoded bodies to SVG markup in a buffer of its
+  own and writes it out in M210_SVG_BUFFER_SIZE pieces. It is reused
+  from one file to another:
+
+  m210_svg_new()
+  m210_svg_set_style()     - optional, polyline is the default
+  m210_svg_begin()         - file 1
+  m210_svg_write_bodies()
+  ...
+  m210_svg_end()
+  m210_svg_begin()         - file 2
+  ...
+  m210_svg_free()
+
+  Writers are not shared between threads, give each its own.
+*/
+enum m210_err m210_svg_new(m210_svg *svgp);
+void m210_svg_free(m210_svg *svgp);
+
+void m210_svg_set_style(m210_svg svg, enum m210_svg_style style);
+
+enum m210_err m210_svg_begin(m210_svg svg, FILE *file);
+enum m210_err m210_svg_write_bodies(m210_svg svg, int16_t const *xs,
+				    int16_t const *ys,
+				    uint16_t const *pressures, size_t count);
+enum m210_err m210_svg_end(m210_svg svg);
+enum m210_err m210_svg_abort(m210_svg svg);
+
+#endif /* SVG_H */
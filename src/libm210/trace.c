@@ -0,0 +1,432 @@
+/* libm210
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+/*
+  Trace file:
+
+  * 8 bytes: M210_TRACE_MAGIC
+  * records until the end of the file
+
+  Record:
+
+  * 1 byte: M210_TRACE_REQUEST, M210_TRACE_REPORT or
+    M210_TRACE_TIMEOUT
+  * 1 byte: interface number
+  * varint: microseconds since the previous record, or since
+    recording began
+  * varint: length of data, requests and reports only
+  * data, requests and reports only
+
+  Varints are little-endian base 128: seven bits per byte, the high
+  bit is set on all but the last byte. A download is mostly
+  reports which arrive less than 16 ms apart, those take 69 bytes.
+*/
+
+#define M210_TRACE_REQUEST 'W'
+#define M210_TRACE_REPORT 'R'
+#define M210_TRACE_TIMEOUT 'T'
+
+/* Longer records than this are not written by any transport. */
+#define M210_TRACE_MAX_DATA 512
+
+struct m210_trace_recorder {
+	struct m210_dev_transport transport; /* The one recorded. */
+	FILE *file;
+	struct timespec last; /* When the previous record was written. */
+};
+
+struct m210_trace_record {
+	int type;
+	int interface;
+	uint64_t time; /* Microseconds since the beginning. */
+	size_t size;
+	uint8_t data[M210_TRACE_MAX_DATA];
+};
+
+struct m210_trace_player {
+	FILE *file;
+	double speed;
+	struct timespec start;
+	int has_record;
+	struct m210_trace_record record; /* The next one, if has_record. */
+	struct m210_trace_counters counters;
+};
+
+static uint64_t m210_trace_us_between(struct timespec const *const from_ptr,
+				      struct timespec const *const to_ptr)
+{
+	return ((to_ptr->tv_sec - from_ptr->tv_sec) * UINT64_C(1000000)
+		+ (to_ptr->tv_nsec - from_ptr->tv_nsec) / 1000);
+}
+
+static int m210_trace_put_varint(FILE *const file, uint64_t value)
+{
+	while (value >= 0x80) {
+		if (putc((value & 0x7f) | 0x80, file) == EOF) {
+			return -1;
+		}
+		value >>= 7;
+	}
+	return putc(value, file) == EOF ? -1 : 0;
+}
+
+static enum m210_err m210_trace_get_varint(FILE *const file,
+					   uint64_t *const value_ptr)
+{
+	uint64_t value = 0;
+
+	for (int shift = 0; shift < 64; shift += 7) {
+		int const c = getc(file);
+
+		if (c == EOF) {
+			return ferror(file) ? M210_ERR_SYS : M210_ERR_BAD_TRACE;
+		}
+		value |= (uint64_t) (c & 0x7f) << shift;
+		if (!(c & 0x80)) {
+			*value_ptr = value;
+			return M210_ERR_OK;
+		}
+	}
+	return M210_ERR_BAD_TRACE;
+}
+
+static enum m210_err m210_trace_put(struct m210_trace_recorder *const recorder_ptr,
+				    int const type, int const interface,
+				    uint8_t const *const data,
+				    size_t const size)
+{
+	enum m210_err err = M210_ERR_OK;
+	FILE *const file = recorder_ptr->file;
+	struct timespec now;
+
+	/* Interface 1 can be read from another thread. */
+	flockfile(file);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (putc(type, file) == EOF || putc(interface, file) == EOF
+	    || m210_trace_put_varint(file, m210_trace_us_between(&recorder_ptr->last,
+								 &now))) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	recorder_ptr->last = now;
+
+	if (type == M210_TRACE_TIMEOUT) {
+		goto out;
+	}
+
+	if (m210_trace_put_varint(file, size)
+	    || (size && fwrite(data, size, 1, file) != 1)) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+out:
+	funlockfile(file);
+	return err;
+}
+
+static enum m210_err m210_trace_record_write(void *const arg,
+					     uint8_t const *const request,
+					     size_t const size)
+{
+	struct m210_trace_recorder *const recorder_ptr = arg;
+	enum m210_err err;
+
+	err = recorder_ptr->transport.write(recorder_ptr->transport.arg,
+					    request, size);
+	if (err) {
+		return err;
+	}
+	return m210_trace_put(recorder_ptr, M210_TRACE_REQUEST, 0, request,
+			      size);
+}
+
+static enum m210_err m210_trace_record_read(void *const arg,
+					    int const interface,
+					    void *const report,
+					    size_t const size,
+					    size_t *const size_ptr,
+					    int const timeout)
+{
+	struct m210_trace_recorder *const recorder_ptr = arg;
+	enum m210_err err;
+
+	err = recorder_ptr->transport.read(recorder_ptr->transport.arg,
+					   interface, report, size, size_ptr,
+					   timeout);
+	if (err == M210_ERR_DEV_TIMEOUT) {
+		enum m210_err const put_err = m210_trace_put(recorder_ptr,
+							     M210_TRACE_TIMEOUT,
+							     interface,
+							     NULL, 0);
+		return put_err ? put_err : err;
+	}
+	if (err) {
+		return err;
+	}
+	return m210_trace_put(recorder_ptr, M210_TRACE_REPORT, interface,
+			      report, *size_ptr);
+}
+
+static enum m210_err m210_trace_record_close(void *const arg)
+{
+	struct m210_trace_recorder *const recorder_ptr = arg;
+	enum m210_err err = M210_ERR_OK;
+
+	if (recorder_ptr->transport.close) {
+		err = recorder_ptr->transport.close(recorder_ptr->transport.arg);
+	}
+	if (fflush(recorder_ptr->file) && !err) {
+		err = M210_ERR_SYS;
+	}
+	free(recorder_ptr);
+	return err;
+}
+
+enum m210_err m210_trace_record(struct m210_dev_transport *const transport_ptr,
+				FILE *const file)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_trace_recorder *recorder_ptr;
+
+	recorder_ptr = malloc(sizeof(struct m210_trace_recorder));
+	if (recorder_ptr == NULL) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	if (fwrite(M210_TRACE_MAGIC, strlen(M210_TRACE_MAGIC), 1, file) != 1) {
+		free(recorder_ptr);
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	recorder_ptr->transport = *transport_ptr;
+	recorder_ptr->file = file;
+	clock_gettime(CLOCK_MONOTONIC, &recorder_ptr->last);
+
+	transport_ptr->write = m210_trace_record_write;
+	transport_ptr->read = m210_trace_record_read;
+	transport_ptr->close = m210_trace_record_close;
+	transport_ptr->arg = recorder_ptr;
+out:
+	return err;
+}
+
+/* Makes sure the next record is in player_ptr->record. Returns
+ * M210_ERR_UNEXPECTED_EOF at the end of the trace. */
+static enum m210_err m210_trace_peek(struct m210_trace_player *const player_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_trace_record *const record_ptr = &player_ptr->record;
+	FILE *const file = player_ptr->file;
+	uint64_t delta;
+	uint64_t size;
+	int type;
+	int interface;
+
+	if (player_ptr->has_record) {
+		goto out;
+	}
+
+	type = getc(file);
+	if (type == EOF) {
+		err = ferror(file) ? M210_ERR_SYS : M210_ERR_UNEXPECTED_EOF;
+		goto out;
+	}
+
+	interface = getc(file);
+	if (interface == EOF) {
+		err = ferror(file) ? M210_ERR_SYS : M210_ERR_BAD_TRACE;
+		goto out;
+	}
+
+	if ((type != M210_TRACE_REQUEST && type != M210_TRACE_REPORT
+	     && type != M210_TRACE_TIMEOUT)
+	    || interface >= M210_DEV_USB_INTERFACE_COUNT) {
+		err = M210_ERR_BAD_TRACE;
+		goto out;
+	}
+
+	err = m210_trace_get_varint(file, &delta);
+	if (err) {
+		goto out;
+	}
+
+	size = 0;
+	if (type != M210_TRACE_TIMEOUT) {
+		err = m210_trace_get_varint(file, &size);
+		if (err) {
+			goto out;
+		}
+		if (size > M210_TRACE_MAX_DATA) {
+			err = M210_ERR_BAD_TRACE;
+			goto out;
+		}
+		if (size && fread(record_ptr->data, size, 1, file) != 1) {
+			err = ferror(file) ? M210_ERR_SYS : M210_ERR_BAD_TRACE;
+			goto out;
+		}
+	}
+
+	record_ptr->type = type;
+	record_ptr->interface = interface;
+	record_ptr->time += delta;
+	record_ptr->size = size;
+	player_ptr->has_record = 1;
+out:
+	return err;
+}
+
+/* Waits until the next record is due at the replay speed. */
+static void m210_trace_wait(struct m210_trace_player const *const player_ptr)
+{
+	struct timespec due = player_ptr->start;
+	uint64_t us;
+
+	if (player_ptr->speed <= 0) {
+		return;
+	}
+
+	us = player_ptr->record.time / player_ptr->speed;
+	due.tv_sec += us / 1000000;
+	due.tv_nsec += (us % 1000000) * 1000;
+	if (due.tv_nsec >= 1000000000) {
+		due.tv_nsec -= 1000000000;
+		++due.tv_sec;
+	}
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due,
+			       NULL) == EINTR) {
+	}
+}
+
+static enum m210_err m210_trace_replay_write(void *const arg,
+					     uint8_t const *const request,
+					     size_t const size)
+{
+	struct m210_trace_player *const player_ptr = arg;
+	struct m210_trace_record const *const record_ptr = &player_ptr->record;
+	enum m210_err err;
+
+	err = m210_trace_peek(player_ptr);
+	if (err) {
+		return err;
+	}
+
+	if (record_ptr->type != M210_TRACE_REQUEST
+	    || record_ptr->size != size
+	    || memcmp(record_ptr->data, request, size)) {
+		return M210_ERR_TRACE_MISMATCH;
+	}
+
+	player_ptr->has_record = 0;
+	++player_ptr->counters.requests;
+	return M210_ERR_OK;
+}
+
+static enum m210_err m210_trace_replay_read(void *const arg,
+					    int const interface,
+					    void *const report,
+					    size_t const size,
+					    size_t *const size_ptr,
+					    int const timeout)
+{
+	struct m210_trace_player *const player_ptr = arg;
+	struct m210_trace_record const *const record_ptr = &player_ptr->record;
+	enum m210_err err;
+
+	/* The recorded outcome is replayed whatever the timeout. */
+	(void) timeout;
+
+	err = m210_trace_peek(player_ptr);
+	if (err) {
+		return err;
+	}
+
+	if (record_ptr->type == M210_TRACE_REQUEST
+	    || record_ptr->interface != interface) {
+		return M210_ERR_TRACE_MISMATCH;
+	}
+
+	m210_trace_wait(player_ptr);
+	player_ptr->has_record = 0;
+
+	if (record_ptr->type == M210_TRACE_TIMEOUT) {
+		++player_ptr->counters.timeouts;
+		return M210_ERR_DEV_TIMEOUT;
+	}
+
+	*size_ptr = record_ptr->size < size ? record_ptr->size : size;
+	memcpy(report, record_ptr->data, *size_ptr);
+	++player_ptr->counters.reports;
+	return M210_ERR_OK;
+}
+
+static enum m210_err m210_trace_replay_close(void *const arg)
+{
+	free(arg);
+	return M210_ERR_OK;
+}
+
+enum m210_err m210_trace_replay(struct m210_dev_transport *const transport_ptr,
+				FILE *const file, double const speed)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_trace_player *player_ptr = NULL;
+	char magic[sizeof(M210_TRACE_MAGIC) - 1];
+
+	if (fread(magic, sizeof(magic), 1, file) != 1) {
+		err = ferror(file) ? M210_ERR_SYS : M210_ERR_BAD_TRACE;
+		goto out;
+	}
+	if (memcmp(magic, M210_TRACE_MAGIC, sizeof(magic))) {
+		err = M210_ERR_BAD_TRACE;
+		goto out;
+	}
+
+	player_ptr = calloc(1, sizeof(struct m210_trace_player));
+	if (player_ptr == NULL) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	player_ptr->file = file;
+	player_ptr->speed = speed;
+	clock_gettime(CLOCK_MONOTONIC, &player_ptr->start);
+
+	transport_ptr->write = m210_trace_replay_write;
+	transport_ptr->read = m210_trace_replay_read;
+	transport_ptr->close = m210_trace_replay_close;
+	transport_ptr->arg = player_ptr;
+out:
+	return err;
+}
+
+void m210_trace_get_counters(struct m210_dev_transport const *const transport_ptr,
+			     struct m210_trace_counters *const counters_ptr)
+{
+	struct m210_trace_player const *const player_ptr = transport_ptr->arg;
+
+	*counters_ptr = player_ptr->counters;
+}
@@ -0,0 +1,54 @@
+/* libm210
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+
+#include "dev.h"
+#include "err.h"
+
+#define M210_TRACE_MAGIC "M210TRC1"
+
+/* Counts of what a trace holds, or what of it has been replayed. */
+struct m210_trace_counters {
+	unsigned long requests;
+	unsigned long reports;
+	unsigned long timeouts;
+};
+
+/* Wraps *transportp so that every request written and every report
+ * read, and every read which timed out, is appended to file with
+ * the time since the previous one. Closing the wrapper closes the
+ * wrapped transport and flushes file, but leaves it open. */
+enum m210_err m210_trace_record(struct m210_dev_transport *transportp,
+				FILE *file);
+
+/* Fills *transportp with a transport which plays back the trace in
+ * file: requests written must be the ones recorded, reads return
+ * the recorded reports and timeouts. Replies keep their original
+ * pace divided by speed, or come at once if speed is 0. Closing
+ * the transport leaves file open. */
+enum m210_err m210_trace_replay(struct m210_dev_transport *transportp,
+				FILE *file, double speed);
+
+/* Tells how much of the trace a replay transport has played. */
+void m210_trace_get_counters(struct m210_dev_transport const *transportp,
+			     struct m210_trace_counters *countersp);
+
+#endif /* TRACE_H */
@@ -0,0 +1,221 @@
+/* libm210
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/input.h>
+#include <linux/uinput.h>
+#include <sys/ioctl.h>
+
+#include "uinput.h"
+
+#define M210_UINPUT_PATH "/dev/uinput"
+#define M210_UINPUT_NAME "Pegasus Mobile NoteTaker (M210) pen"
+#define M210_UINPUT_VENDOR 0x0e20
+#define M210_UINPUT_PRODUCT 0x0101
+
+/* Three axes, four buttons and SYN_REPORT. */
+#define M210_UINPUT_MAX_EVENTS 8
+
+struct m210_uinput {
+	int fd;
+	uint8_t state; /* M210_DEV_SAMPLE_* bits reported last. */
+};
+
+/* Buttons and the sample state bits they follow. */
+static struct {
+	uint16_t code;
+	uint8_t bit;
+} const M210_UINPUT_BUTTONS[] = {
+	{BTN_TOOL_PEN, M210_DEV_SAMPLE_IN_RANGE},
+	{BTN_TOUCH, M210_DEV_SAMPLE_TIP},
+	{BTN_STYLUS, M210_DEV_SAMPLE_SW1},
+	{BTN_STYLUS2, M210_DEV_SAMPLE_SW2}
+};
+
+#define M210_UINPUT_BUTTON_COUNT (sizeof(M210_UINPUT_BUTTONS)	\
+				  / sizeof(M210_UINPUT_BUTTONS[0]))
+
+static enum m210_err m210_uinput_setup_abs(int const fd, uint16_t const code,
+					   uint16_t const maximum)
+{
+	struct uinput_abs_setup abs_setup;
+
+	memset(&abs_setup, 0, sizeof(struct uinput_abs_setup));
+	abs_setup.code = code;
+	abs_setup.absinfo.minimum = 0;
+	abs_setup.absinfo.maximum = maximum;
+	if (ioctl(fd, UI_SET_ABSBIT, code) == -1
+	    || ioctl(fd, UI_ABS_SETUP, &abs_setup) == -1) {
+		return M210_ERR_SYS;
+	}
+	return M210_ERR_OK;
+}
+
+enum m210_err m210_uinput_new(struct m210_uinput **const uinput_ptr_ptr,
+			      struct m210_uinput_ranges const *const ranges_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_uinput *uinput_ptr = NULL;
+	struct uinput_setup setup;
+
+	uinput_ptr = malloc(sizeof(struct m210_uinput));
+	if (uinput_ptr == NULL) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	uinput_ptr->state = 0;
+
+	uinput_ptr->fd = open(M210_UINPUT_PATH, O_WRONLY | O_CLOEXEC);
+	if (uinput_ptr->fd == -1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	if (ioctl(uinput_ptr->fd, UI_SET_EVBIT, EV_SYN) == -1
+	    || ioctl(uinput_ptr->fd, UI_SET_EVBIT, EV_KEY) == -1
+	    || ioctl(uinput_ptr->fd, UI_SET_EVBIT, EV_ABS) == -1
+	    || ioctl(uinput_ptr->fd, UI_SET_PROPBIT, INPUT_PROP_POINTER) == -1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	for (size_t i = 0; i < M210_UINPUT_BUTTON_COUNT; ++i) {
+		if (ioctl(uinput_ptr->fd, UI_SET_KEYBIT,
+			  M210_UINPUT_BUTTONS[i].code) == -1) {
+			err = M210_ERR_SYS;
+			goto out;
+		}
+	}
+
+	err = m210_uinput_setup_abs(uinput_ptr->fd, ABS_X, ranges_ptr->max_x);
+	if (err) {
+		goto out;
+	}
+	err = m210_uinput_setup_abs(uinput_ptr->fd, ABS_Y, ranges_ptr->max_y);
+	if (err) {
+		goto out;
+	}
+	err = m210_uinput_setup_abs(uinput_ptr->fd, ABS_PRESSURE,
+				    ranges_ptr->max_pressure);
+	if (err) {
+		goto out;
+	}
+
+	memset(&setup, 0, sizeof(struct uinput_setup));
+	setup.id.bustype = BUS_USB;
+	setup.id.vendor = M210_UINPUT_VENDOR;
+	setup.id.product = M210_UINPUT_PRODUCT;
+	strncpy(setup.name, M210_UINPUT_NAME, UINPUT_MAX_NAME_SIZE - 1);
+
+	if (ioctl(uinput_ptr->fd, UI_DEV_SETUP, &setup) == -1
+	    || ioctl(uinput_ptr->fd, UI_DEV_CREATE) == -1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+out:
+	if (err && uinput_ptr) {
+		int const original_errno = errno;
+
+		if (uinput_ptr->fd != -1) {
+			close(uinput_ptr->fd);
+		}
+		free(uinput_ptr);
+		uinput_ptr = NULL;
+		errno = original_errno;
+	}
+	*uinput_ptr_ptr = uinput_ptr;
+	return err;
+}
+
+enum m210_err m210_uinput_free(struct m210_uinput **const uinput_ptr_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_uinput *const uinput_ptr = *uinput_ptr_ptr;
+
+	if (uinput_ptr == NULL) {
+		goto out;
+	}
+
+	if (ioctl(uinput_ptr->fd, UI_DEV_DESTROY) == -1) {
+		err = M210_ERR_SYS;
+	}
+	if (close(uinput_ptr->fd) == -1) {
+		err = M210_ERR_SYS;
+	}
+	free(uinput_ptr);
+	*uinput_ptr_ptr = NULL;
+out:
+	return err;
+}
+
+static void m210_uinput_event(struct input_event *const event_ptr,
+			      uint16_t const type, uint16_t const code,
+			      int32_t const value)
+{
+	/* The kernel stamps events itself. */
+	memset(event_ptr, 0, sizeof(struct input_event));
+	event_ptr->type = type;
+	event_ptr->code = code;
+	event_ptr->value = value;
+}
+
+enum m210_err m210_uinput_write_sample(struct m210_uinput *const uinput_ptr,
+				       struct m210_dev_sample const *const sample_ptr)
+{
+	struct input_event events[M210_UINPUT_MAX_EVENTS];
+	size_t count = 0;
+	uint8_t const changed = uinput_ptr->state ^ sample_ptr->state;
+	ssize_t written;
+
+	/* Unchanged axes are filtered out by the kernel. */
+	m210_uinput_event(&events[count++], EV_ABS, ABS_X, sample_ptr->x);
+	m210_uinput_event(&events[count++], EV_ABS, ABS_Y, sample_ptr->y);
+	m210_uinput_event(&events[count++], EV_ABS, ABS_PRESSURE,
+			  sample_ptr->pressure);
+
+	for (size_t i = 0; i < M210_UINPUT_BUTTON_COUNT; ++i) {
+		uint8_t const bit = M210_UINPUT_BUTTONS[i].bit;
+
+		if (changed & bit) {
+			m210_uinput_event(&events[count++], EV_KEY,
+					  M210_UINPUT_BUTTONS[i].code,
+					  !!(sample_ptr->state & bit));
+		}
+	}
+
+	m210_uinput_event(&events[count++], EV_SYN, SYN_REPORT, 0);
+
+	/* One write per report: the whole frame reaches the input
+	 * subsystem at once. */
+	written = write(uinput_ptr->fd, events,
+			count * sizeof(struct input_event));
+	if (written == -1) {
+		return M210_ERR_SYS;
+	}
+	if ((size_t) written != count * sizeof(struct input_event)) {
+		errno = EIO;
+		return M210_ERR_SYS;
+	}
+
+	uinput_ptr->state = sample_ptr->state;
+	return M210_ERR_OK;
+}
@@ -0,0 +1,52 @@
+/* libm210
+ * Copyright (C) 2011 Tuomas Jorma Juhani Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UINPUT_H
+#define UINPUT_H
+
+#include <stdint.h>
+
+#include "dev.h"
+#include "err.h"
+
+/* The protocol notes do not tell the ranges of tablet mode reports,
+ * these cover everything a report can carry. */
+#define M210_UINPUT_DEFAULT_MAX_X 0xffff
+#define M210_UINPUT_DEFAULT_MAX_Y 0xffff
+#define M210_UINPUT_DEFAULT_MAX_PRESSURE 0x3ff
+
+/* A virtual pen tablet fed with samples of a real one. */
+typedef struct m210_uinput *m210_uinput;
+
+/* Largest values of the axes, the input subsystem scales by them. */
+struct m210_uinput_ranges {
+	uint16_t max_x;
+	uint16_t max_y;
+	uint16_t max_pressure;
+};
+
+/* Creates the virtual device through /dev/uinput. */
+enum m210_err m210_uinput_new(m210_uinput *uinputp,
+			      struct m210_uinput_ranges const *rangesp);
+enum m210_err m210_uinput_free(m210_uinput *uinputp);
+
+/* Injects a sample as a single write of events terminated by
+ * SYN_REPORT. Buttons are reported only when they change. */
+enum m210_err m210_uinput_write_sample(m210_uinput uinput,
+				       struct m210_dev_sample const *samplep);
+
+#endif /* UINPUT_H */
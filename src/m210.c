@@ -18,20 +18,39 @@
 #define _GNU_SOURCE
 
 #include <err.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <sys/stat.h>
+
+#include "libm210/archive.h"
 #include "libm210/dev.h"
+#include "libm210/index.h"
 #include "libm210/note.h"
+#include "libm210/rawnote.h"
+#include "libm210/ring.h"
+#include "libm210/svg.h"
+#include "libm210/trace.h"
+#include "libm210/uinput.h"
 
-extern char *program_invocation_name;
+/* Samples buffered between the reader thread and the output, about
+ * five seconds worth of pen reports. */
+#define CAPTURE_RING_CAPACITY 1024
 
-static const int svg_stroke_width = 20;
-static const char *const svg_stroke_color = "black";
+/* How often uinput checks whether it has been interrupted,
+ * milliseconds. */
+#define UINPUT_STOP_INTERVAL 100
+
+extern char *program_invocation_name;
 
 static void print_help_hint(void)
 {
@@ -55,10 +74,26 @@ static void print_help(void)
 {
 	printf("Usage: %s --help\n"
 	       "  or:  %s --version\n"
-	       "  or:  %s info\n"
-	       "  or:  %s dump [--output-file=FILE]\n"
+	       "  or:  %s info [--stats[=FORMAT]]\n"
+	       "  or:  %s dump [--output-file=FILE [--resume]] [--record=TRACE]\n"
+	       "               [--convert [--output-dir=DIR] [--overwrite]\n"
+	       "                [--simplify=TOLERANCE] [--compact]]\n"
+	       "               [--stats[=FORMAT]]\n"
+	       "  or:  %s dump --all [--output-dir=DIR] [--overwrite]\n"
 	       "  or:  %s convert [--input-file=FILE] [--output-dir=DIR] [--overwrite]\n"
+	       "                  [--jobs=N] [--simplify=TOLERANCE] [--compact]\n"
+	       "                  [--note=N[,M,...]]\n"
+	       "  or:  %s list [--input-file=FILE] [--index-file=FILE]\n"
 	       "  or:  %s delete\n"
+	       "  or:  %s daemon [--output-dir=DIR] [--convert [--simplify=TOLERANCE]\n"
+	       "                 [--compact]] [--delete]\n"
+	       "  or:  %s capture [--output-file=FILE] [--count=N]\n"
+	       "  or:  %s uinput [--max-x=N] [--max-y=N] [--max-pressure=N]\n"
+	       "                 [--count=N]\n"
+	       "  or:  %s replay [--input-file=TRACE] [--output-file=FILE]\n"
+	       "                 [--speed=FACTOR]\n"
+	       "  or:  %s archive [--input-file=FILE] [--output-file=FILE]\n"
+	       "                  [--extract]\n"
 	       "\n"
 	       "Download notes from Pegasus Tablet Mobile NoteTaker (M210) and\n"
 	       "convert them to SVG files.\n"
@@ -68,198 +103,2748 @@ static void print_help(void)
 	       " --version              output version information and exit\n"
 	       "\n"
 	       "Dump options:\n"
-	       "    --output-file=FILE  defaults to standard output\n"
+	       "    --output-file=FILE  defaults to standard output, unless\n"
+	       "                        --convert is given\n"
+	       "    --resume            journal received packets to\n"
+	       "                        FILE.journal and keep them if an\n"
+	       "                        earlier dump was interrupted; the\n"
+	       "                        device still sends everything, only\n"
+	       "                        packets lost both times are resent\n"
+	       "    --all               download all attached devices at\n"
+	       "                        once, each to m210_dump_PORT in\n"
+	       "                        the output directory, replaced\n"
+	       "                        only with --overwrite\n"
+	       "    --convert           convert notes to SVG files while\n"
+	       "                        downloading, takes --output-dir,\n"
+	       "                        --overwrite, --simplify and\n"
+	       "                        --compact like convert\n"
+	       "    --record=TRACE      record all traffic with the device\n"
+	       "                        with timestamps to TRACE\n"
+	       "    --stats[=FORMAT]    print transfer counters and times to\n"
+	       "                        standard error when done, FORMAT is\n"
+	       "                        text, the default, or json\n"
 	       "\n"
-	       "Convert options:\n"
+	       "Info options:\n"
+	       "    --stats[=FORMAT]    like with dump\n"
+	       "\n",
+	       program_invocation_name, program_invocation_name,
+	       program_invocation_name, program_invocation_name,
+	       program_invocation_name, program_invocation_name,
+	       program_invocation_name, program_invocation_name,
+	       program_invocation_name, program_invocation_name,
+	       program_invocation_name, program_invocation_name,
+	       program_invocation_name);
+
+	/* Split up, string literals of C99 are limited in length. */
+	printf("Convert options:\n"
 	       "    --input-file=FILE   defaults to standard input\n"
 	       "    --output-dir=DIR    directory for SVG files,\n"
 	       "                        defaults to current directory\n"
 	       "    --overwrite         overwrite existing SVG files\n"
+	       "    --jobs=N            convert N notes at a time,\n"
+	       "                        defaults to 1\n"
+	       "    --simplify=TOLERANCE\n"
+	       "                        drop points of strokes while staying\n"
+	       "                        within TOLERANCE device units of the\n"
+	       "                        original, report the points kept\n"
+	       "    --compact           write strokes as relative SVG paths\n"
+	       "                        instead of absolute polylines\n"
+	       "    --note=N[,M,...]    convert only the listed notes, items\n"
+	       "                        can be ranges like 3-7, found through\n"
+	       "                        FILE.idx of --input-file if current\n"
+	       "\n"
+	       "Daemon options:\n"
+	       "    --output-dir=DIR    directory for downloads, defaults to\n"
+	       "                        current directory\n"
+	       "    --convert           convert notes to SVG files while\n"
+	       "                        downloading, takes --simplify and\n"
+	       "                        --compact like convert\n"
+	       "    --delete            erase notes from the device after\n"
+	       "                        they have been downloaded\n"
+	       "\n"
+	       "Capture options:\n"
+	       "    --output-file=FILE  defaults to standard output\n"
+	       "    --count=N           stop after N pen reports, defaults\n"
+	       "                        to capturing until interrupted\n"
 	       "\n"
-	       "Examples:\n"
+	       "Uinput options:\n"
+	       "    --max-x=N           largest x reported, defaults to 65535\n"
+	       "    --max-y=N           largest y reported, defaults to 65535\n"
+	       "    --max-pressure=N    largest pressure reported, defaults\n"
+	       "                        to 1023\n"
+	       "    --count=N           stop after N pen reports, defaults\n"
+	       "                        to injecting until interrupted\n"
+	       "\n"
+	       "Replay options:\n"
+	       "    --input-file=TRACE  trace recorded by dump --record,\n"
+	       "                        defaults to standard input\n"
+	       "    --output-file=FILE  defaults to standard output\n"
+	       "    --speed=FACTOR      replay FACTOR times as fast as\n"
+	       "                        recorded, 0 for no waiting at all,\n"
+	       "                        defaults to 1\n"
+	       "\n"
+	       "List options:\n"
+	       "    --input-file=FILE   dump to list, its index is built to\n"
+	       "                        FILE.idx unless it is there already\n"
+	       "    --index-file=FILE   index to list, without --input-file\n"
+	       "                        the dump is not read at all\n"
+	       "\n"
+	       "Archive options:\n"
+	       "    --input-file=FILE   dump or archive, defaults to\n"
+	       "                        standard input\n"
+	       "    --output-file=FILE  defaults to standard output\n"
+	       "    --extract           write the raw dump instead of an\n"
+	       "                        archive\n"
+	       "\n");
+	printf("Examples:\n"
 	       "Download notes to a file:\n"
 	       "  m210 dump > notes\n"
 	       "\n"
+	       "Download notes of every attached device:\n"
+	       "  m210 dump --all --output-dir=dumps\n"
+	       "\n"
+	       "Download notes and convert them at the same time:\n"
+	       "  m210 dump --output-file=notes --convert\n"
+	       "\n"
 	       "Convert downloaded notes to SVG files:\n"
 	       "  m210 convert < notes\n"
 	       "\n"
+	       "Convert just notes 2 and 5 to 7:\n"
+	       "  m210 convert --note=2,5-7 < notes\n"
+	       "\n"
+	       "List notes of a downloaded dump:\n"
+	       "  m210 list --input-file=notes\n"
+	       "\n"
 	       "Erase notes from the device's memory:\n"
 	       "  m210 delete\n"
 	       "\n"
+	       "Download every device as soon as it is plugged in:\n"
+	       "  m210 daemon --output-dir=dumps --convert\n"
+	       "\n"
+	       "Follow the pen live, one report per line: seconds since the\n"
+	       "start, x, y, pressure and in-range, tip and switch flags:\n"
+	       "  m210 capture\n"
+	       "\n"
+	       "Use the pen as a system pen tablet, print latencies when\n"
+	       "interrupted:\n"
+	       "  m210 uinput\n"
+	       "\n"
+	       "Record a download, then download from the recording again\n"
+	       "ten times as fast:\n"
+	       "  m210 dump --output-file=notes --record=notes.trace\n"
+	       "  m210 replay --input-file=notes.trace --speed=10 > notes2\n"
+	       "\n"
+	       "Pack downloaded notes to a fraction of their size, and back:\n"
+	       "  m210 archive --input-file=notes --output-file=notes.arc\n"
+	       "  m210 archive --extract --input-file=notes.arc > notes\n"
+	       "\n"
 	       "Display device information:\n"
 	       "  m210 info\n"
 	       "\n"
 	       "Report bugs to <%s>\n"
 	       "Homepage: <%s>\n"
 	       "\n",
-	       program_invocation_name, program_invocation_name,
-	       program_invocation_name, program_invocation_name,
-	       program_invocation_name, program_invocation_name,
 	       PACKAGE_BUGREPORT, PACKAGE_URL);
 }
 
-static FILE* open_svg_file(int note_number, char *output_mode)
+static int parse_positive_long(char const *str, long *value_ptr)
+{
+	char *end;
+	long value;
+
+	errno = 0;
+	value = strtol(str, &end, 10);
+	if (errno || end == str || *end != '\0' || value < 1) {
+		return -1;
+	}
+	*value_ptr = value;
+	return 0;
+}
+
+static int parse_non_negative_double(char const *str, double *value_ptr)
+{
+	char *end;
+	double value;
+
+	errno = 0;
+	value = strtod(str, &end);
+	if (errno || end == str || *end != '\0' || !(value >= 0)
+	    || !isfinite(value)) {
+		return -1;
+	}
+	*value_ptr = value;
+	return 0;
+}
+
+/* Returns the name of the SVG file of a note, to be freed with
+ * free(), or NULL if out of memory. Notes of the first dump of a
+ * concatenated input are named after their number alone, those of
+ * the later ones get the ordinal of their dump, counted from 1, as
+ * a suffix so that numbers repeating across dumps do not collide. */
+static char *svg_file_name(int note_number, unsigned dump_index)
+{
+	char *filename = NULL;
+	int length;
+
+	if (dump_index == 0) {
+		length = asprintf(&filename, "m210_note_%d.svg", note_number);
+	} else {
+		length = asprintf(&filename, "m210_note_%d_%u.svg",
+				  note_number, dump_index + 1);
+	}
+	if (length == -1) {
+		/* On error, asprintf() leaves the contents of
+		 * filename undefined. */
+		return NULL;
+	}
+	return filename;
+}
+
+static FILE* open_svg_file(int note_number, unsigned dump_index,
+			   char *output_mode)
+{
+	FILE *file = NULL;
+	char *filename = NULL;
+
+	filename = svg_file_name(note_number, dump_index);
+	if (filename == NULL) {
+		goto out;
+	}
+
+	file = fopen(filename, output_mode);
+out:
+	free(filename);
+	return file;
+}
+
+/* Set of note numbers, one bit per number. */
+struct note_set {
+	uint8_t bits[32];
+};
+
+struct convert_opts {
+	char *output_mode;
+	double tolerance; /* Device units, 0 keeps every point. */
+	enum m210_svg_style style;
+	int has_selection;
+	struct note_set selection; /* Notes to convert if has_selection. */
+};
+
+static void note_set_add(struct note_set *set, int number)
+{
+	set->bits[number / 8] |= 1 << (number % 8);
+}
+
+static int note_set_has(struct note_set const *set, int number)
+{
+	return set->bits[number / 8] & (1 << (number % 8));
+}
+
+static int is_selected(struct convert_opts const *opts, int number)
+{
+	return !opts->has_selection || note_set_has(&opts->selection, number);
+}
+
+/* Parses "N[,M,...]" where each item is a note number or a range
+ * "A-B" of them, and adds the numbers to set. */
+static int parse_note_set(char const *str, struct note_set *set)
+{
+	char const *p = str;
+
+	while (1) {
+		char *end;
+		long first;
+		long last;
+
+		errno = 0;
+		first = strtol(p, &end, 10);
+		if (errno || end == p || first < 1 || first > UINT8_MAX) {
+			return -1;
+		}
+		last = first;
+		p = end;
+
+		if (*p == '-') {
+			++p;
+			errno = 0;
+			last = strtol(p, &end, 10);
+			if (errno || end == p || last < first
+			    || last > UINT8_MAX) {
+				return -1;
+			}
+			p = end;
+		}
+
+		for (long number = first; number <= last; ++number) {
+			note_set_add(set, number);
+		}
+
+		if (*p == '\0') {
+			return 0;
+		}
+		if (*p != ',') {
+			return -1;
+		}
+		++p;
+	}
+}
+
+/* Rendering state of one thread: the writer and note-sized buffers
+ * for decoded bodies, reused from note to note. */
+struct renderer {
+	struct convert_opts const *opts;
+	m210_svg svg;
+	size_t capacity;
+	int16_t *xs;
+	int16_t *ys;
+	uint16_t *pressures;
+	size_t points_in;
+	size_t points_out;
+	struct note_set converted;
+};
+
+static enum m210_err renderer_init(struct renderer *renderer,
+				   struct convert_opts const *opts)
+{
+	enum m210_err err;
+
+	memset(renderer, 0, sizeof(struct renderer));
+	renderer->opts = opts;
+
+	err = m210_svg_new(&renderer->svg);
+	if (!err) {
+		m210_svg_set_style(renderer->svg, opts->style);
+	}
+	return err;
+}
+
+static void renderer_free(struct renderer *renderer)
+{
+	m210_svg_free(&renderer->svg);
+	free(renderer->xs);
+	free(renderer->ys);
+	free(renderer->pressures);
+	memset(renderer, 0, sizeof(struct renderer));
+}
+
+static enum m210_err renderer_reserve(struct renderer *renderer,
+				      size_t count)
+{
+	int16_t *xs;
+	int16_t *ys;
+	uint16_t *pressures;
+
+	if (count <= renderer->capacity) {
+		return M210_ERR_OK;
+	}
+
+	xs = realloc(renderer->xs, count * sizeof(int16_t));
+	if (xs == NULL) {
+		return M210_ERR_SYS;
+	}
+	renderer->xs = xs;
+
+	ys = realloc(renderer->ys, count * sizeof(int16_t));
+	if (ys == NULL) {
+		return M210_ERR_SYS;
+	}
+	renderer->ys = ys;
+
+	pressures = realloc(renderer->pressures, count * sizeof(uint16_t));
+	if (pressures == NULL) {
+		return M210_ERR_SYS;
+	}
+	renderer->pressures = pressures;
+
+	renderer->capacity = count;
+	return M210_ERR_OK;
+}
+
+/* Simplifies the first *countp buffered bodies if asked to, and
+ * updates *countp to the number of bodies left. */
+static enum m210_err renderer_simplify(struct renderer *renderer,
+				       size_t *countp)
+{
+	enum m210_err err;
+
+	renderer->points_in += *countp;
+	if (renderer->opts->tolerance > 0) {
+		err = m210_note_simplify(renderer->xs, renderer->ys,
+					 renderer->pressures, countp,
+					 renderer->opts->tolerance);
+		if (err) {
+			return err;
+		}
+	}
+	renderer->points_out += *countp;
+	return M210_ERR_OK;
+}
+
+/* Writes the first count buffered bodies out. */
+static enum m210_err renderer_write(struct renderer *renderer, size_t count)
+{
+	return m210_svg_write_bodies(renderer->svg, renderer->xs, renderer->ys,
+				     renderer->pressures, count);
+}
+
+/* Finishes and closes an SVG file. Returns -1 if failed is set or
+ * if finishing fails, in the latter case *errmsg_ptr describes the
+ * failure and errno is left as the failed call set it. If failed is
+ * set, errno is left as it was. */
+static int close_svg_file(FILE *output_file, m210_svg svg, int failed,
+			  char const **errmsg_ptr)
+{
+	int result = failed ? -1 : 0;
+	int const errnum = errno;
+
+	if (failed) {
+		/* Keep what was rendered before the failure. */
+		m210_svg_abort(svg);
+	} else if (m210_svg_end(svg)) {
+		*errmsg_ptr = "error: failed to write to output file";
+		result = -1;
+	}
+
+	if (output_file != stdout && fclose(output_file) && !failed) {
+		*errmsg_ptr = "error: failed to close output file";
+		result = -1;
+	}
+	if (failed) {
+		errno = errnum;
+	}
+	return result;
+}
+
+/* Renders a note from a mapped dump to output_file and closes it.
+ * Does not print anything, on failure returns -1, sets *errmsg_ptr
+ * and leaves errno as the failed call set it. Safe to call from
+ * several threads at once as long as each uses its own renderer. */
+static int render_span(struct m210_note_span const *span_ptr,
+		       struct renderer *renderer, FILE *output_file,
+		       char const **errmsg_ptr)
+{
+	int result = -1;
+
+	if (m210_svg_begin(renderer->svg, output_file)) {
+		*errmsg_ptr = "error: failed to write to output file";
+		goto out;
+	}
+
+	if (span_ptr->bodyc > 0) {
+		size_t count = span_ptr->bodyc;
+
+		if (renderer_reserve(renderer, count)) {
+			*errmsg_ptr = "error: failed to allocate note buffer";
+			goto out;
+		}
+
+		m210_note_decode_bodies(renderer->xs, renderer->ys,
+					renderer->pressures,
+					span_ptr->rawbodies, count);
+
+		/* Only runs out of memory. */
+		if (renderer_simplify(renderer, &count)) {
+			*errmsg_ptr = "error: failed to simplify note";
+			goto out;
+		}
+
+		if (renderer_write(renderer, count)) {
+			*errmsg_ptr = "error: failed to write to output file";
+			goto out;
+		}
+	}
+
+	result = 0;
+out:
+	if (close_svg_file(output_file, renderer->svg, result == -1,
+			   errmsg_ptr) == -1) {
+		result = -1;
+	}
+	return result;
+}
+
+/* Renders a note of the dump_index'th dump to its SVG file, reports
+ * failures like render_span(). */
+static int span_to_svg(struct m210_note_span const *span_ptr,
+		       unsigned dump_index, struct renderer *renderer,
+		       char const **errmsg_ptr)
+{
+	FILE *output_file;
+
+	output_file = open_svg_file(span_ptr->number, dump_index,
+				    renderer->opts->output_mode);
+	if (output_file == NULL) {
+		*errmsg_ptr = "error: failed to create SVG file";
+		return -1;
+	}
+	return render_span(span_ptr, renderer, output_file, errmsg_ptr);
+}
+
+/* Renders the next note of map. Returns 1 if there may be more to
+ * come, 0 at the end of the last dump and -1 on failure. Concatenated
+ * dumps are walked one after another, *dump_index_ptr counts the end
+ * heads passed. */
+static int mapped_note_to_svg(m210_note_map map, unsigned *dump_index_ptr,
+			      struct renderer *renderer)
+{
+	int result = -1;
+	struct m210_note_span span;
+	enum m210_err err;
+	char const *errmsg = NULL;
+
+	err = m210_note_map_read(map, &span);
+	if (err) {
+		m210_err_perror(err, "error: failed to read note head");
+		goto out;
+	}
+
+	if (span.number == 0) {
+		/* End of one dump, the next one might follow. */
+		if (m210_note_map_eof(map)) {
+			result = 0;
+		} else {
+			++*dump_index_ptr;
+			result = 1;
+		}
+		goto out;
+	}
+
+	if (!is_selected(renderer->opts, span.number)) {
+		/* The next head was found through next_pos, the
+		 * bodies are never touched. */
+		result = 1;
+		goto out;
+	}
+	note_set_add(&renderer->converted, span.number);
+
+	if (span_to_svg(&span, *dump_index_ptr, renderer, &errmsg) == -1) {
+		perror(errmsg);
+		goto out;
+	}
+
+	result = 1;
+out:
+	return result;
+}
+
+/* Reads the index at index_path if it is there and matches the dump.
+ * Returns 0 if it does, -1 quietly if it is missing, stale or
+ * malformed. */
+static int read_current_index(struct m210_index *index_ptr,
+			      char const *index_path, int dump_fd)
+{
+	enum m210_err err;
+	FILE *index_file;
+
+	index_file = fopen(index_path, "rb");
+	if (index_file == NULL) {
+		return -1;
+	}
+	err = m210_index_read(index_ptr, index_file);
+	fclose(index_file);
+	if (err) {
+		return -1;
+	}
+	if (!m210_index_is_current(index_ptr, dump_fd)) {
+		m210_index_free(index_ptr);
+		return -1;
+	}
+	return 0;
+}
+
+/* Reads the note of an index entry straight from its offset in map,
+ * checking that the head there is still the one indexed. */
+static enum m210_err read_indexed_span(m210_note_map map,
+				       struct m210_index_entry const *entry,
+				       struct m210_note_span *span_ptr)
+{
+	enum m210_err err;
+
+	err = m210_note_map_read_at(map, entry->offset, entry->bodyc,
+				    span_ptr);
+	if (!err && (span_ptr->number != entry->number
+		     || span_ptr->state != entry->state)) {
+		err = M210_ERR_BAD_INDEX;
+	}
+	return err;
+}
+
+/* Returns the entry of the next selected note after *dump_ptr and
+ * *number_ptr, which are advanced to it, or NULL after the last
+ * dump. Looks notes up by dump and number instead of walking the
+ * dump. */
+static struct m210_index_entry const *next_indexed_note(
+	struct m210_index const *index, struct convert_opts const *opts,
+	uint32_t *dump_ptr, int *number_ptr)
+{
+	uint32_t const dump_count = (index->count
+				     ? index->entries[index->count - 1].dump + 1
+				     : 0);
+
+	for (; *dump_ptr < dump_count; ++*dump_ptr, *number_ptr = 0) {
+		while (++*number_ptr <= UINT8_MAX) {
+			struct m210_index_entry const *entry;
+
+			if (!is_selected(opts, *number_ptr)) {
+				continue;
+			}
+			entry = m210_index_find(index, *dump_ptr, *number_ptr);
+			if (entry) {
+				return entry;
+			}
+		}
+	}
+	return NULL;
+}
+
+/* Renders the selected notes of map, found through index. */
+static int indexed_notes_to_svg(m210_note_map map,
+				struct m210_index const *index,
+				struct renderer *renderer)
+{
+	struct m210_index_entry const *entry;
+	uint32_t dump = 0;
+	int number = 0;
+
+	while ((entry = next_indexed_note(index, renderer->opts, &dump,
+					  &number))) {
+		struct m210_note_span span;
+		enum m210_err err;
+		char const *errmsg = NULL;
+
+		err = read_indexed_span(map, entry, &span);
+		if (err) {
+			m210_err_perror(err, "error: failed to read note head");
+			return -1;
+		}
+		note_set_add(&renderer->converted, span.number);
+
+		if (span_to_svg(&span, entry->dump, renderer, &errmsg) == -1) {
+			perror(errmsg);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+struct convert_job {
+	struct m210_note_span span;
+	unsigned dump_index;
+	int is_done;
+	char *temp_path; /* Rendered but not yet published, or NULL. */
+	int result;
+	int errnum;
+	char const *errmsg;
+};
+
+struct convert_pool {
+	pthread_mutex_t mutex;
+	struct convert_job *jobs;
+	size_t job_count;
+	size_t next_job;
+	/* Index of the first failed job, job_count if none has
+	 * failed. Jobs after it are not started, just like the
+	 * serial conversion would stop there. */
+	size_t failed_job;
+	/* Jobs before it have been published or have failed. Jobs
+	 * are rendered to temporary files and published in note
+	 * order, so no note after a failed one is left behind even
+	 * if it was already being rendered when the failure
+	 * happened. */
+	size_t published_job;
+	mode_t file_mode;
+	struct convert_opts const *opts;
+	size_t points_in;
+	size_t points_out;
+};
+
+/* Creates a temporary file next to the SVG file of job, with the
+ * permissions fopen() would give the SVG file. */
+static FILE *open_temp_svg_file(struct convert_job *job, mode_t file_mode)
 {
 	FILE *file = NULL;
 	char *filename = NULL;
+	int fd = -1;
+
+	filename = svg_file_name(job->span.number, job->dump_index);
+	if (filename == NULL || asprintf(&job->temp_path, "%s.XXXXXX",
+					 filename) == -1) {
+		job->temp_path = NULL;
+		goto out;
+	}
+
+	fd = mkstemp(job->temp_path);
+	if (fd == -1 || fchmod(fd, file_mode) == -1) {
+		goto out;
+	}
+
+	file = fdopen(fd, "w");
+out:
+	if (file == NULL) {
+		int const errnum = errno;
+
+		if (fd != -1) {
+			close(fd);
+			unlink(job->temp_path);
+		}
+		free(job->temp_path);
+		job->temp_path = NULL;
+		errno = errnum;
+	}
+	free(filename);
+	return file;
+}
+
+/* Moves the temporary file of job to its SVG file. Without
+ * overwriting, an existing SVG file fails the job like it would
+ * fail the serial conversion. */
+static void publish_job(struct convert_job *job, struct convert_pool *pool)
+{
+	char *filename;
+	int failed = 1;
+
+	if (job->temp_path == NULL) {
+		return;
+	}
+
+	filename = svg_file_name(job->span.number, job->dump_index);
+	if (filename == NULL) {
+		goto out;
+	}
+
+	if (strchr(pool->opts->output_mode, 'x')) {
+		/* Claim the name first, rename() would replace. */
+		int const fd = open(filename, O_WRONLY | O_CREAT | O_EXCL,
+				    pool->file_mode);
+		if (fd == -1) {
+			goto out;
+		}
+		close(fd);
+	}
+
+	failed = rename(job->temp_path, filename) == -1;
+	if (failed && strchr(pool->opts->output_mode, 'x')) {
+		int const errnum = errno;
+		unlink(filename);
+		errno = errnum;
+	}
+out:
+
+	if (failed && job->result == 0) {
+		job->result = -1;
+		job->errnum = errno;
+		job->errmsg = "error: failed to create SVG file";
+	}
+
+	if (failed) {
+		unlink(job->temp_path);
+	}
+	free(job->temp_path);
+	job->temp_path = NULL;
+	free(filename);
+}
+
+/* Publishes jobs in note order as far as they are done, up to and
+ * including the first failed one. Called with the mutex held. */
+static void publish_done_jobs(struct convert_pool *pool)
+{
+	while (pool->published_job <= pool->failed_job
+	       && pool->published_job < pool->job_count) {
+		struct convert_job *const job = pool->jobs
+			+ pool->published_job;
+
+		if (!job->is_done) {
+			break;
+		}
+
+		/* A failed note keeps what was rendered of it, like
+		 * in the serial conversion. */
+		publish_job(job, pool);
+		if (job->result == -1) {
+			pool->failed_job = pool->published_job;
+		}
+		++pool->published_job;
+	}
+}
+
+static void *convert_worker(void *arg)
+{
+	struct convert_pool *const pool = arg;
+	struct renderer renderer;
+	enum m210_err const init_err = renderer_init(&renderer, pool->opts);
+	int const init_errnum = errno;
+
+	while (1) {
+		struct convert_job *job;
+		FILE *output_file;
+		size_t jobi;
+
+		pthread_mutex_lock(&pool->mutex);
+		jobi = pool->next_job++;
+		if (jobi >= pool->job_count || jobi > pool->failed_job) {
+			pthread_mutex_unlock(&pool->mutex);
+			break;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+
+		job = pool->jobs + jobi;
+		if (init_err) {
+			job->result = -1;
+			job->errmsg = "error: failed to create SVG writer";
+			errno = init_errnum;
+		} else if ((output_file = open_temp_svg_file(
+				    job, pool->file_mode)) == NULL) {
+			job->result = -1;
+			job->errmsg = "error: failed to create SVG file";
+		} else {
+			job->result = render_span(&job->span, &renderer,
+						  output_file, &job->errmsg);
+		}
+		if (job->result == -1) {
+			job->errnum = errno;
+		}
+
+		pthread_mutex_lock(&pool->mutex);
+		job->is_done = 1;
+		if (job->result == -1 && jobi < pool->failed_job) {
+			pool->failed_job = jobi;
+		}
+		publish_done_jobs(pool);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->points_in += renderer.points_in;
+	pool->points_out += renderer.points_out;
+	pthread_mutex_unlock(&pool->mutex);
+
+	renderer_free(&renderer);
+	return NULL;
+}
+
+/* Queues a job for a note of the dump_index'th dump. */
+static int add_job(struct convert_pool *pool, size_t *capacity_ptr,
+		   struct m210_note_span const *span_ptr, unsigned dump_index)
+{
+	if (pool->job_count == *capacity_ptr) {
+		size_t const capacity = *capacity_ptr ? *capacity_ptr * 2 : 64;
+		struct convert_job *const jobs = realloc(
+			pool->jobs, capacity * sizeof(struct convert_job));
+		if (jobs == NULL) {
+			return -1;
+		}
+		pool->jobs = jobs;
+		*capacity_ptr = capacity;
+	}
+	memset(pool->jobs + pool->job_count, 0, sizeof(struct convert_job));
+	pool->jobs[pool->job_count].span = *span_ptr;
+	pool->jobs[pool->job_count++].dump_index = dump_index;
+	return 0;
+}
+
+/* Collects the selected notes of the mapped dump, through index if
+ * there is one and otherwise by following next_pos, and renders
+ * them on a pool of worker threads. Errors are reported after all
+ * workers have finished, in note order, so the output is the same
+ * as the serial conversion would produce. */
+static int convert_parallel(m210_note_map map, struct m210_index const *index,
+			    struct renderer *renderer, long job_thread_count)
+{
+	int result = -1;
+	enum m210_err index_err = M210_ERR_OK;
+	struct convert_pool pool;
+	pthread_t *threads = NULL;
+	long started_count = 0;
+	size_t capacity = 0;
+	unsigned dump_index = 0;
+	struct m210_index_entry const *entry;
+	uint32_t dump = 0;
+	int number = 0;
+
+	memset(&pool, 0, sizeof(pool));
+	pool.opts = renderer->opts;
+
+	while (index && (entry = next_indexed_note(index, pool.opts, &dump,
+						   &number))) {
+		struct m210_note_span span;
+
+		index_err = read_indexed_span(map, entry, &span);
+		if (index_err) {
+			break;
+		}
+		note_set_add(&renderer->converted, span.number);
+
+		if (add_job(&pool, &capacity, &span, entry->dump)) {
+			perror("error: failed to index notes");
+			goto out;
+		}
+	}
+
+	while (index == NULL) {
+		struct m210_note_span span;
+
+		index_err = m210_note_map_read(map, &span);
+		if (index_err) {
+			break;
+		}
+
+		if (span.number == 0) {
+			/* End of one dump, the next one might follow. */
+			if (m210_note_map_eof(map)) {
+				break;
+			}
+			++dump_index;
+			continue;
+		}
+
+		if (!is_selected(pool.opts, span.number)) {
+			continue;
+		}
+		note_set_add(&renderer->converted, span.number);
+
+		if (add_job(&pool, &capacity, &span, dump_index)) {
+			perror("error: failed to index notes");
+			goto out;
+		}
+	}
+	pool.failed_job = pool.job_count;
+
+	/* The mode fopen() would create files with. */
+	pool.file_mode = umask(0);
+	umask(pool.file_mode);
+	pool.file_mode = 0666 & ~pool.file_mode;
+
+	if ((size_t) job_thread_count > pool.job_count) {
+		job_thread_count = pool.job_count;
+	}
+
+	threads = calloc(job_thread_count ? job_thread_count : 1,
+			 sizeof(pthread_t));
+	if (threads == NULL) {
+		perror("error: failed to start workers");
+		goto out;
+	}
+
+	pthread_mutex_init(&pool.mutex, NULL);
+	for (; started_count < job_thread_count; ++started_count) {
+		int const errnum = pthread_create(threads + started_count,
+						  NULL, convert_worker, &pool);
+		if (errnum) {
+			if (started_count) {
+				/* The ones running finish the work. */
+				break;
+			}
+			errno = errnum;
+			perror("error: failed to start workers");
+			pthread_mutex_destroy(&pool.mutex);
+			goto out;
+		}
+	}
+	for (long i = 0; i < started_count; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_mutex_destroy(&pool.mutex);
+
+	renderer->points_in += pool.points_in;
+	renderer->points_out += pool.points_out;
+
+	if (pool.failed_job < pool.job_count) {
+		struct convert_job const *const job = pool.jobs + pool.failed_job;
+		errno = job->errnum;
+		perror(job->errmsg);
+		goto out;
+	}
+
+	if (index_err) {
+		m210_err_perror(index_err, "error: failed to read note head");
+		goto out;
+	}
+
+	result = 0;
+out:
+	if (pool.jobs) {
+		/* Rendered after a failed note, never published. */
+		for (size_t i = 0; i < pool.job_count; ++i) {
+			if (pool.jobs[i].temp_path) {
+				unlink(pool.jobs[i].temp_path);
+				free(pool.jobs[i].temp_path);
+			}
+		}
+	}
+	free(threads);
+	free(pool.jobs);
+	return result;
+}
+
+/* Warns about selected notes which were not found and reports the
+ * effect of simplification. */
+static void report_conversion(struct renderer const *renderer)
+{
+	struct convert_opts const *const opts = renderer->opts;
+
+	if (opts->has_selection) {
+		for (int number = 1; number <= UINT8_MAX; ++number) {
+			if (note_set_has(&opts->selection, number)
+			    && !note_set_has(&renderer->converted, number)) {
+				fprintf(stderr, "warning: note %d not found\n",
+					number);
+			}
+		}
+	}
+
+	if (opts->tolerance > 0) {
+		printf("Simplified:	 %zu of %zu points kept (%.1f%%)\n",
+		       renderer->points_out, renderer->points_in,
+		       (renderer->points_in
+			? 100.0 * renderer->points_out / renderer->points_in
+			: 100.0));
+	}
+}
+
+static int convert_cmd(int argc, char **argv)
+{
+	int result = -1;
+	FILE *input_file = NULL;
+	char *input_path = NULL;
+	char *index_path = NULL;
+	struct m210_index index;
+	int has_index = 0;
+	m210_note_map map = NULL;
+	struct renderer renderer;
+	struct convert_opts convert_opts;
+	struct stat input_stat;
+	enum m210_err err;
+	long job_thread_count = 1;
+	unsigned dump_index = 0;
+	const struct option opts[] = {
+		{"input-file", required_argument, NULL, 'i'},
+		{"output-dir", required_argument, NULL, 'd'},
+		{"overwrite", no_argument, NULL, 'f'},
+		{"jobs", required_argument, NULL, 'j'},
+		{"simplify", required_argument, NULL, 's'},
+		{"compact", no_argument, NULL, 'c'},
+		{"note", required_argument, NULL, 'n'},
+		{0, 0, 0, 0}
+	};
+
+	input_file = stdin;
+	memset(&index, 0, sizeof(index));
+	memset(&renderer, 0, sizeof(renderer));
+	memset(&convert_opts, 0, sizeof(convert_opts));
+	convert_opts.output_mode = "wx";
+	convert_opts.style = M210_SVG_STYLE_POLYLINE;
+
+	while (1) {
+		int option = getopt_long(argc, argv, "+", opts, NULL);
+
+		if (option == -1) {
+			break;
+		}
+
+		switch (option) {
+		case 'i':
+			input_file = fopen(optarg, "rb");
+			if (input_file == NULL) {
+				perror("error: failed to open input file");
+				goto out;
+			}
+			/* The index is next to the input file, which
+			 * --output-dir must not move. */
+			free(input_path);
+			input_path = realpath(optarg, NULL);
+			if (input_path == NULL) {
+				perror("error: failed to resolve input file");
+				goto out;
+			}
+			break;
+		case 'd':
+			if (chdir(optarg)) {
+				perror("error: failed to change the current "
+				       "working directory");
+				goto out;
+			}
+			break;
+		case 'f':
+			convert_opts.output_mode = "w";
+			break;
+		case 'j':
+			if (parse_positive_long(optarg, &job_thread_count)) {
+				fprintf(stderr, "error: invalid job count '%s'\n",
+					optarg);
+				print_help_hint();
+				goto out;
+			}
+			break;
+		case 's':
+			if (parse_non_negative_double(optarg, &convert_opts.tolerance)) {
+				fprintf(stderr, "error: invalid tolerance '%s'\n",
+					optarg);
+				print_help_hint();
+				goto out;
+			}
+			break;
+		case 'c':
+			convert_opts.style = M210_SVG_STYLE_PATH;
+			break;
+		case 'n':
+			if (parse_note_set(optarg, &convert_opts.selection)) {
+				fprintf(stderr, "error: invalid note list '%s'\n",
+					optarg);
+				print_help_hint();
+				goto out;
+			}
+			convert_opts.has_selection = 1;
+			break;
+		default:
+			print_help_hint();
+			goto out;
+		}
+	}
+
+	if (optind != argc) {
+		fprintf(stderr, "error: unexpected convert arguments\n");
+		print_help_hint();
+		goto out;
+	}
+
+	if (fstat(fileno(input_file), &input_stat) == -1) {
+		perror("error: failed to stat input file");
+		goto out;
+	}
+
+	/* Regular files are mapped to memory and read in place,
+	 * pipes and other streams are read to memory first. Archives
+	 * are decoded to memory either way. */
+	if (S_ISREG(input_stat.st_mode)) {
+		err = m210_note_map_open(&map, fileno(input_file));
+	} else {
+		err = m210_note_map_open_stream(&map, input_file);
+	}
+	if (err) {
+		m210_err_perror(err, "error: failed to read input file");
+		goto out;
+	}
+
+	/* Selected notes are sought through the index of the input
+	 * file if it is current. Building one would walk the whole
+	 * dump, which is what it is meant to save. */
+	if (convert_opts.has_selection && input_path
+	    && S_ISREG(input_stat.st_mode)) {
+		if (asprintf(&index_path, "%s%s", input_path,
+			     M210_INDEX_SUFFIX) == -1) {
+			index_path = NULL;
+			perror("error: failed to allocate memory");
+			goto out;
+		}
+		has_index = read_current_index(&index, index_path,
+					       fileno(input_file)) == 0;
+	}
+
+	err = renderer_init(&renderer, &convert_opts);
+	if (err) {
+		m210_err_perror(err, "error: failed to create SVG writer");
+		goto out;
+	}
+
+	if (job_thread_count > 1) {
+		result = convert_parallel(map, has_index ? &index : NULL,
+					  &renderer, job_thread_count);
+	} else if (has_index) {
+		result = indexed_notes_to_svg(map, &index, &renderer);
+	} else {
+		do {
+			result = mapped_note_to_svg(map, &dump_index,
+						    &renderer);
+		} while (result == 1);
+	}
+
+	if (result == 0) {
+		report_conversion(&renderer);
+	}
+
+out:
+	renderer_free(&renderer);
+	m210_index_free(&index);
+	free(index_path);
+	free(input_path);
+
+	if (map) {
+		err = m210_note_map_close(&map);
+		if (err) {
+			m210_err_perror(err, "error: failed to unmap input file");
+			result = -1;
+		}
+	}
+
+	if (input_file && input_file != stdin && fclose(input_file)) {
+		perror("failed to close input file");
+		result = -1;
+	}
+	return result;
+}
+
+static char const *note_state_name(uint8_t state)
+{
+	switch (state) {
+	case M210_RAWNOTE_STATE_EMPTY:
+		return "empty";
+	case M210_RAWNOTE_STATE_UNFINISHED:
+		return "open";
+	case M210_RAWNOTE_STATE_FINISHED_BY_USER:
+		return "closed";
+	case M210_RAWNOTE_STATE_FINISHED_BY_SOFTWARE:
+		return "closed-sw";
+	default:
+		return "unknown";
+	}
+}
+
+/* Loads the index of a dump: from index_path if it is there and
+ * matches the dump, otherwise builds it from the dump and stores it
+ * to index_path. Without a dump (dump_fd == -1), the index file is
+ * all there is. */
+static int load_index(struct m210_index *index_ptr, char const *index_path,
+		      int dump_fd)
+{
+	int result = -1;
+	enum m210_err err;
+	FILE *index_file;
+
+	if (dump_fd == -1) {
+		index_file = fopen(index_path, "rb");
+		if (index_file == NULL) {
+			perror("error: failed to open index file");
+			goto out;
+		}
+		err = m210_index_read(index_ptr, index_file);
+		fclose(index_file);
+		if (err) {
+			m210_err_perror(err, "error: failed to read index file");
+			goto out;
+		}
+		result = 0;
+		goto out;
+	}
+
+	if (read_current_index(index_ptr, index_path, dump_fd) == 0) {
+		result = 0;
+		goto out;
+	}
+
+	err = m210_index_build(index_ptr, dump_fd);
+	if (err) {
+		m210_err_perror(err, "error: failed to index notes");
+		goto out;
+	}
+
+	/* The index is a cache, failing to store it is not fatal. */
+	index_file = fopen(index_path, "wb");
+	if (index_file == NULL) {
+		perror("warning: failed to create index file");
+	} else {
+		err = m210_index_write(index_ptr, index_file);
+		if (fclose(index_file) || err) {
+			perror("warning: failed to write index file");
+			remove(index_path);
+		}
+	}
+	result = 0;
+out:
+	return result;
+}
+
+static int list_cmd(int argc, char **argv)
+{
+	int result = -1;
+	char const *input_path = NULL;
+	char *index_path = NULL;
+	int dump_fd = -1;
+	struct m210_index index;
+	const struct option opts[] = {
+		{"input-file", required_argument, NULL, 'i'},
+		{"index-file", required_argument, NULL, 'x'},
+		{0, 0, 0, 0}
+	};
+
+	memset(&index, 0, sizeof(index));
+
+	while (1) {
+		int option = getopt_long(argc, argv, "+", opts, NULL);
+
+		if (option == -1) {
+			break;
+		}
+
+		switch (option) {
+		case 'i':
+			input_path = optarg;
+			break;
+		case 'x':
+			free(index_path);
+			index_path = strdup(optarg);
+			if (index_path == NULL) {
+				perror("error: failed to allocate memory");
+				goto out;
+			}
+			break;
+		default:
+			print_help_hint();
+			goto out;
+		}
+	}
+
+	if (optind != argc) {
+		fprintf(stderr, "error: unexpected list arguments\n");
+		print_help_hint();
+		goto out;
+	}
+
+	if (input_path == NULL && index_path == NULL) {
+		fprintf(stderr, "error: list needs an input or an index file\n");
+		print_help_hint();
+		goto out;
+	}
+
+	if (index_path == NULL
+	    && asprintf(&index_path, "%s%s", input_path,
+			M210_INDEX_SUFFIX) == -1) {
+		index_path = NULL;
+		perror("error: failed to allocate memory");
+		goto out;
+	}
+
+	if (input_path) {
+		dump_fd = open(input_path, O_RDONLY);
+		if (dump_fd == -1) {
+			perror("error: failed to open input file");
+			goto out;
+		}
+	}
+
+	if (load_index(&index, index_path, dump_fd)) {
+		goto out;
+	}
+
+	printf("%4s %6s %10s %-9s %8s  %s\n",
+	       "Dump", "Number", "Offset", "State", "Bodies", "Bounding box");
+	for (size_t i = 0; i < index.count; ++i) {
+		struct m210_index_entry const *const entry = index.entries + i;
+
+		printf("%4lu %6d %10llu %-9s %8lu  ",
+		       (unsigned long) entry->dump + 1, entry->number, (unsigned long long) entry->offset,
+		       note_state_name(entry->state),
+		       (unsigned long) entry->bodyc);
+		if (entry->min_x > entry->max_x) {
+			printf("-\n");
+		} else {
+			printf("%d,%d %d,%d\n", entry->min_x, entry->min_y,
+			       entry->max_x, entry->max_y);
+		}
+	}
+
+	result = 0;
+out:
+	m210_index_free(&index);
+	if (dump_fd != -1 && close(dump_fd)) {
+		perror("failed to close input file");
+		result = -1;
+	}
+	free(index_path);
+	return result;
+}
+
+static int delete_cmd(int argc, char **argv)
+{
+	int result = -1;
+	m210_dev dev;
+	enum m210_err err;
+	const struct option opts[] = {
+		{0, 0, 0, 0}
+	};
+
+	while (1) {
+		int option = getopt_long(argc, argv, "+", opts, NULL);
+
+		if (option == -1) {
+			break;
+		}
+
+		switch (option) {
+		default:
+			print_help_hint();
+			goto out;
+		}
+	}
+
+	if (optind != argc) {
+		fprintf(stderr, "error: unexpected delete arguments\n");
+		print_help_hint();
+		goto out;
+	}
+
+	err = m210_dev_connect(&dev);
+	if (err) {
+		m210_err_perror(err, "failed to open device");
+		goto out;
+	}
+
+	err = m210_dev_delete_notes(dev);
+	if (err) {
+		m210_err_perror(err, "failed to delete notes");
+		goto out;
+	}
+	result = 0;
+out:
+	if (dev) {
+		err = m210_dev_disconnect(&dev);
+		if (err) {
+			m210_err_perror(err, "error: failed to disconnect");
+			result = -1;
+		}
+	}
+	return result;
+}
+
+/* Download state shared by the device sink, which fills the
+ * buffer, and the converter thread, which renders notes as soon as
+ * they are complete in the buffer. */
+struct live_convert {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	uint8_t *data;
+	size_t capacity;
+	size_t size;
+	int is_finished;
+	FILE *raw_file;
+	struct renderer renderer;
+	/* Result of the converter thread, errmsg and errnum are set
+	 * on system errors, err on the others. */
+	int result;
+	enum m210_err err;
+	char const *errmsg;
+	int errnum;
+};
+
+static enum m210_err live_convert_begin(void *arg, uint32_t size)
+{
+	struct live_convert *const live = arg;
+	uint8_t *const data = malloc(size);
+
+	if (data == NULL) {
+		return M210_ERR_SYS;
+	}
+
+	pthread_mutex_lock(&live->mutex);
+	live->data = data;
+	live->capacity = size;
+	pthread_cond_signal(&live->cond);
+	pthread_mutex_unlock(&live->mutex);
+	return M210_ERR_OK;
+}
+
+static enum m210_err live_convert_write(void *arg, uint8_t const *data,
+					size_t size)
+{
+	struct live_convert *const live = arg;
+
+	if (live->raw_file && fwrite(data, size, 1, live->raw_file) != 1) {
+		return M210_ERR_SYS;
+	}
+
+	if (live->capacity - live->size < size) {
+		errno = ENOBUFS;
+		return M210_ERR_SYS;
+	}
+
+	/* The converter reads only up to live->size, the bytes past
+	 * it are not shared until the size is published. */
+	memcpy(live->data + live->size, data, size);
+
+	pthread_mutex_lock(&live->mutex);
+	live->size += size;
+	pthread_cond_signal(&live->cond);
+	pthread_mutex_unlock(&live->mutex);
+	return M210_ERR_OK;
+}
+
+/* Waits until the buffer has grown past size or the download has
+ * finished. Returns the new size, which equals size if there is
+ * nothing more to come. */
+static size_t live_convert_wait(struct live_convert *live, size_t size)
+{
+	size_t new_size;
+
+	pthread_mutex_lock(&live->mutex);
+	while (live->size == size && !live->is_finished) {
+		pthread_cond_wait(&live->cond, &live->mutex);
+	}
+	new_size = live->size;
+	pthread_mutex_unlock(&live->mutex);
+	return new_size;
+}
+
+static void *live_convert_worker(void *arg)
+{
+	struct live_convert *const live = arg;
+	m210_note_map map = NULL;
+	size_t size;
+
+	live->result = -1;
+
+	/* The buffer is allocated once the size is known. */
+	pthread_mutex_lock(&live->mutex);
+	while (live->data == NULL && !live->is_finished) {
+		pthread_cond_wait(&live->cond, &live->mutex);
+	}
+	size = live->size;
+	pthread_mutex_unlock(&live->mutex);
+
+	if (live->data == NULL) {
+		/* The download finished without ever beginning: the
+		 * device has no notes. A failed download is reported
+		 * by the downloader. */
+		live->result = 0;
+		goto out;
+	}
+
+	live->err = m210_note_map_open_buffer(&map, live->data, size);
+	if (live->err) {
+		live->errmsg = "error: failed to create note reader";
+		live->errnum = errno;
+		goto out;
+	}
+
+	while (1) {
+		struct m210_note_span span;
+
+		live->err = m210_note_map_read(map, &span);
+		if (live->err == M210_ERR_UNEXPECTED_EOF) {
+			size_t const new_size = live_convert_wait(live, size);
+
+			if (new_size == size) {
+				/* The download ended before the
+				 * last note. */
+				goto out;
+			}
+			size = new_size;
+			m210_note_map_set_size(map, size);
+			continue;
+		}
+		if (live->err) {
+			goto out;
+		}
+
+		if (span.number == 0) {
+			/* A download is a single dump, the rest is
+			 * padding. */
+			break;
+		}
+
+		if (!is_selected(live->renderer.opts, span.number)) {
+			continue;
+		}
+		note_set_add(&live->renderer.converted, span.number);
+
+		if (span_to_svg(&span, 0, &live->renderer,
+				&live->errmsg) == -1) {
+			live->err = M210_ERR_SYS;
+			live->errnum = errno;
+			goto out;
+		}
+	}
+
+	live->result = 0;
+out:
+	m210_note_map_close(&map);
+	return NULL;
+}
+
+/* Downloads notes and converts them to SVG files while the download
+ * is still in progress. The raw dump is written to raw_file too,
+ * unless it is NULL. The download is journaled to journal, unless
+ * it is NULL. */
+static int dump_and_convert(m210_dev dev, FILE *raw_file, FILE *journal,
+			    struct convert_opts const *convert_opts)
+{
+	int result = -1;
+	struct live_convert live;
+	struct m210_dev_sink const sink = {live_convert_begin,
+					   live_convert_write, &live};
+	pthread_t thread;
+	enum m210_err err;
+
+	memset(&live, 0, sizeof(live));
+	pthread_mutex_init(&live.mutex, NULL);
+	pthread_cond_init(&live.cond, NULL);
+	live.raw_file = raw_file;
+
+	err = renderer_init(&live.renderer, convert_opts);
+	if (err) {
+		m210_err_perror(err, "error: failed to create SVG writer");
+		goto out;
+	}
+
+	errno = pthread_create(&thread, NULL, live_convert_worker, &live);
+	if (errno) {
+		perror("error: failed to create converter thread");
+		goto out;
+	}
+
+	err = m210_dev_resume_notes_to_sink(dev, &sink, journal);
+
+	pthread_mutex_lock(&live.mutex);
+	live.is_finished = 1;
+	pthread_cond_signal(&live.cond);
+	pthread_mutex_unlock(&live.mutex);
+
+	pthread_join(thread, NULL);
+
+	if (err) {
+		/* Conversion failures are a consequence of this. */
+		m210_err_perror(err, "failed to download notes");
+		goto out;
+	}
+
+	if (raw_file && fflush(raw_file)) {
+		perror("error: failed to write to output file");
+		goto out;
+	}
+
+	if (live.result == -1) {
+		if (live.err == M210_ERR_SYS) {
+			errno = live.errnum;
+			perror(live.errmsg);
+		} else {
+			m210_err_perror(live.err,
+					"error: failed to read note head");
+		}
+		goto out;
+	}
+
+	report_conversion(&live.renderer);
+	result = 0;
+out:
+	renderer_free(&live.renderer);
+	free(live.data);
+	pthread_cond_destroy(&live.cond);
+	pthread_mutex_destroy(&live.mutex);
+	return result;
+}
+
+/* Download of one device of dump --all. */
+struct dump_job {
+	struct m210_dev_node const *node;
+	char *output_path;
+	char const *output_mode;
+	enum m210_err err;
+	int errnum;
+	char const *errmsg;
+};
+
+static void *dump_worker(void *arg)
+{
+	struct dump_job *const job = arg;
+	m210_dev dev = NULL;
+	FILE *output_file = NULL;
+	enum m210_err err;
+
+	job->err = m210_dev_connect_node(&dev, job->node);
+	if (job->err) {
+		job->errmsg = "failed to open device";
+		goto out;
+	}
+
+	output_file = fopen(job->output_path, job->output_mode);
+	if (output_file == NULL) {
+		job->err = M210_ERR_SYS;
+		job->errmsg = "failed to open output file";
+		goto out;
+	}
+
+	job->err = m210_dev_download_notes(dev, output_file);
+	if (job->err) {
+		job->errmsg = "failed to download notes";
+		goto out;
+	}
+out:
+	job->errnum = errno;
+
+	if (output_file && fclose(output_file) && !job->err) {
+		job->err = M210_ERR_SYS;
+		job->errnum = errno;
+		job->errmsg = "failed to close output file";
+	}
+
+	err = m210_dev_disconnect(&dev);
+	if (err && !job->err) {
+		job->err = err;
+		job->errnum = errno;
+		job->errmsg = "failed to disconnect";
+	}
+	return NULL;
+}
+
+/* Downloads notes of all attached devices at the same time, each on
+ * its own thread, to files named after the USB port of the device
+ * and opened in output_mode. */
+static int dump_all(char const *output_mode)
+{
+	int result = -1;
+	struct m210_dev_list list;
+	struct dump_job *jobs = NULL;
+	pthread_t *threads = NULL;
+	size_t thread_count = 0;
+	enum m210_err err;
+
+	err = m210_dev_list_find(&list);
+	if (err) {
+		m210_err_perror(err, "failed to find devices");
+		goto out;
+	}
+
+	if (list.count == 0) {
+		m210_err_perror(M210_ERR_NO_DEV, "failed to find devices");
+		goto out;
+	}
+
+	jobs = calloc(list.count, sizeof(struct dump_job));
+	threads = calloc(list.count, sizeof(pthread_t));
+	if (jobs == NULL || threads == NULL) {
+		perror("error: failed to allocate memory");
+		goto out;
+	}
+
+	for (size_t i = 0; i < list.count; ++i) {
+		char const *const port = strrchr(list.nodes[i].usb_syspath,
+						 '/');
+		jobs[i].node = &list.nodes[i];
+		jobs[i].output_mode = output_mode;
+		if (asprintf(&jobs[i].output_path, "m210_dump_%s",
+			     port ? port + 1 : list.nodes[i].usb_syspath) == -1) {
+			jobs[i].output_path = NULL;
+			perror("error: failed to allocate memory");
+			goto out;
+		}
+	}
+
+	for (; thread_count < list.count; ++thread_count) {
+		errno = pthread_create(&threads[thread_count], NULL,
+				       dump_worker, &jobs[thread_count]);
+		if (errno) {
+			perror("error: failed to create download thread");
+			break;
+		}
+	}
+
+	result = thread_count == list.count ? 0 : -1;
+	for (size_t i = 0; i < thread_count; ++i) {
+		pthread_join(threads[i], NULL);
+
+		if (jobs[i].err) {
+			char *msg = NULL;
+
+			if (asprintf(&msg, "error: %s: %s", jobs[i].output_path,
+				     jobs[i].errmsg) == -1) {
+				msg = NULL;
+			}
+			errno = jobs[i].errnum;
+			m210_err_perror(jobs[i].err, msg ? msg : jobs[i].errmsg);
+			free(msg);
+			result = -1;
+		} else {
+			printf("%s\n", jobs[i].output_path);
+		}
+	}
+out:
+	if (jobs) {
+		for (size_t i = 0; i < list.count; ++i) {
+			free(jobs[i].output_path);
+		}
+	}
+	free(jobs);
+	free(threads);
+	m210_dev_list_free(&list);
+	return result;
+}
+
+enum stats_format {
+	STATS_NONE,
+	STATS_TEXT,
+	STATS_JSON
+};
+
+static int parse_stats_format(char const *str, enum stats_format *format_ptr)
+{
+	if (str == NULL || strcmp(str, "text") == 0) {
+		*format_ptr = STATS_TEXT;
+	} else if (strcmp(str, "json") == 0) {
+		*format_ptr = STATS_JSON;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+/* Prints the transfer stats of dev to standard error, where they do
+ * not mix with a dump written to standard output. JSON goes on a
+ * single line, latency bucket i counts reads of less than 2**i
+ * microseconds. */
+static void print_stats(m210_dev dev, enum stats_format format)
+{
+	struct m210_dev_stats stats;
+
+	m210_dev_get_stats(dev, &stats);
+
+	if (format == STATS_JSON) {
+		fprintf(stderr, "{\"requests\": %lu, \"reads\": %lu, "
+			"\"timeouts\": %lu, \"begin_retries\": %lu, "
+			"\"packets\": %lu, \"duplicates\": %lu, "
+			"\"out_of_order\": %lu, \"resends\": %lu, "
+			"\"bytes_written\": %llu, \"begin_us\": %llu, "
+			"\"receive_us\": %llu, \"resend_us\": %llu, "
+			"\"write_us\": %llu, \"read_latencies\": [",
+			stats.requests, stats.reads, stats.timeouts,
+			stats.begin_retries, stats.packets, stats.duplicates,
+			stats.out_of_order, stats.resends, stats.bytes_written,
+			stats.begin_time, stats.receive_time,
+			stats.resend_time, stats.write_time);
+		for (int i = 0; i < M210_DEV_STATS_LATENCY_BUCKETS; ++i) {
+			fprintf(stderr, "%s%lu", i ? ", " : "",
+				stats.read_latencies[i]);
+		}
+		fprintf(stderr, "]}\n");
+		return;
+	}
+
+	fprintf(stderr, "Requests sent:      %lu\n", stats.requests);
+	fprintf(stderr, "Reports read:       %lu\n", stats.reads);
+	fprintf(stderr, "Timeouts:           %lu\n", stats.timeouts);
+	fprintf(stderr, "Count retries:      %lu\n", stats.begin_retries);
+	fprintf(stderr, "Packets received:   %lu\n", stats.packets);
+	fprintf(stderr, "  duplicates:       %lu\n", stats.duplicates);
+	fprintf(stderr, "  out of order:     %lu\n", stats.out_of_order);
+	fprintf(stderr, "Resends requested:  %lu\n", stats.resends);
+	fprintf(stderr, "Bytes written:      %llu\n", stats.bytes_written);
+	fprintf(stderr, "Asking count:       %.3f s\n", stats.begin_time / 1e6);
+	fprintf(stderr, "Receiving:          %.3f s\n",
+		stats.receive_time / 1e6);
+	fprintf(stderr, "Resending:          %.3f s\n",
+		stats.resend_time / 1e6);
+	fprintf(stderr, "Writing:            %.3f s, while receiving "
+		"and resending\n", stats.write_time / 1e6);
+	fprintf(stderr, "Read latency:\n");
+	for (int i = 0; i < M210_DEV_STATS_LATENCY_BUCKETS; ++i) {
+		if (stats.read_latencies[i] == 0) {
+			continue;
+		}
+		if (i == M210_DEV_STATS_LATENCY_BUCKETS - 1) {
+			fprintf(stderr, "  >= %7ld us: %lu\n",
+				1L << (i - 1), stats.read_latencies[i]);
+		} else {
+			fprintf(stderr, "  <  %7ld us: %lu\n",
+				1L << i, stats.read_latencies[i]);
+		}
+	}
+}
+
+static int dump_cmd(int argc, char **argv)
+{
+	int result = -1;
+	m210_dev dev = NULL;
+	FILE *output_file = NULL;
+	enum m210_err err;
+	int convert = 0;
+	int resume = 0;
+	int all = 0;
+	int render = 0;
+	char const *output_path = NULL;
+	char *journal_path = NULL;
+	FILE *journal = NULL;
+	FILE *trace = NULL;
+	enum stats_format stats_format = STATS_NONE;
+	struct convert_opts convert_opts;
+	const struct option opts[] = {
+		{"output-file", required_argument, NULL, 'o'},
+		{"resume", no_argument, NULL, 'r'},
+		{"all", no_argument, NULL, 'a'},
+		{"convert", no_argument, NULL, 'C'},
+		{"output-dir", required_argument, NULL, 'd'},
+		{"overwrite", no_argument, NULL, 'f'},
+		{"simplify", required_argument, NULL, 's'},
+		{"compact", no_argument, NULL, 'c'},
+		{"record", required_argument, NULL, 'R'},
+		{"stats", optional_argument, NULL, 'S'},
+		{0, 0, 0, 0}
+	};
+
+	memset(&convert_opts, 0, sizeof(convert_opts));
+	convert_opts.output_mode = "wx";
+	convert_opts.style = M210_SVG_STYLE_POLYLINE;
+
+	while (1) {
+		int option = getopt_long(argc, argv, "+", opts, NULL);
+
+		if (option == -1) {
+			break;
+		}
+
+		switch (option) {
+		case 'o':
+			output_file = fopen(optarg, "wb");
+			if (output_file == NULL) {
+				perror("error: failed to open output file");
+				goto out;
+			}
+			output_path = optarg;
+			break;
+		case 'r':
+			resume = 1;
+			break;
+		case 'a':
+			all = 1;
+			break;
+		case 'C':
+			convert = 1;
+			break;
+		case 'd':
+			if (chdir(optarg)) {
+				perror("error: failed to change the current "
+				       "working directory");
+				goto out;
+			}
+			break;
+		case 'f':
+			convert_opts.output_mode = "w";
+			break;
+		case 's':
+			if (parse_non_negative_double(optarg, &convert_opts.tolerance)) {
+				fprintf(stderr, "error: invalid tolerance '%s'\n",
+					optarg);
+				print_help_hint();
+				goto out;
+			}
+			render = 1;
+			break;
+		case 'c':
+			convert_opts.style = M210_SVG_STYLE_PATH;
+			render = 1;
+			break;
+		case 'R':
+			trace = fopen(optarg, "wb");
+			if (trace == NULL) {
+				perror("error: failed to open trace file");
+				goto out;
+			}
+			break;
+		case 'S':
+			if (parse_stats_format(optarg, &stats_format)) {
+				fprintf(stderr, "error: invalid stats format "
+					"'%s'\n", optarg);
+				print_help_hint();
+				goto out;
+			}
+			break;
+		default:
+			print_help_hint();
+			goto out;
+		}
+	}
+
+	if (optind != argc) {
+		fprintf(stderr, "error: unexpected dump arguments\n");
+		print_help_hint();
+		goto out;
+	}
+
+	if (all) {
+		if (output_file || resume || convert || render || trace
+		    || stats_format != STATS_NONE) {
+			fprintf(stderr, "error: --all takes only "
+				"--output-dir and --overwrite\n");
+			print_help_hint();
+			goto out;
+		}
+		/* Existing dumps are kept unless asked otherwise. */
+		result = dump_all(strchr(convert_opts.output_mode, 'x')
+				  ? "wbx" : "wb");
+		goto out;
+	}
+
+	/* When converting, the raw dump is written only if asked. */
+	if (output_file == NULL && !convert) {
+		output_file = stdout;
+	}
+
+	if (resume) {
+		int fd;
+
+		if (output_path == NULL) {
+			fprintf(stderr, "error: --resume needs --output-file\n");
+			print_help_hint();
+			goto out;
+		}
+
+		if (asprintf(&journal_path, "%s%s", output_path,
+			     M210_DEV_JOURNAL_SUFFIX) == -1) {
+			journal_path = NULL;
+			perror("error: failed to allocate memory");
+			goto out;
+		}
+
+		fd = open(journal_path, O_RDWR | O_CREAT, 0666);
+		if (fd == -1 || (journal = fdopen(fd, "r+b")) == NULL) {
+			perror("error: failed to open journal file");
+			if (fd != -1) {
+				close(fd);
+			}
+			goto out;
+		}
+	}
+
+	err = m210_dev_connect(&dev);
+	if (err) {
+		m210_err_perror(err, "failed to open device");
+		goto out;
+	}
+
+	if (trace) {
+		err = m210_dev_record(dev, trace);
+		if (err) {
+			m210_err_perror(err, "failed to record traffic");
+			goto out;
+		}
+	}
+
+	if (convert) {
+		if (dump_and_convert(dev, output_file, journal,
+				     &convert_opts) == -1) {
+			goto out;
+		}
+	} else {
+		err = m210_dev_resume_notes(dev, output_file, journal);
+		if (err) {
+			m210_err_perror(err, "failed to download notes");
+			goto out;
+		}
+	}
+
+	result = 0;
+out:
+	if (journal) {
+		if (fclose(journal)) {
+			perror("error: failed to close journal file");
+			result = -1;
+		}
+		if (result == 0) {
+			/* The download is complete, nothing to resume. */
+			remove(journal_path);
+		} else {
+			fprintf(stderr, "Received packets are kept in %s, "
+				"run dump --resume again to continue.\n",
+				journal_path);
+		}
+	}
+	free(journal_path);
+
+	/* Also after a failure, when they are needed the most. */
+	if (dev && stats_format != STATS_NONE) {
+		print_stats(dev, stats_format);
+	}
+
+	if (dev) {
+		err = m210_dev_disconnect(&dev);
+		if (err) {
+			m210_err_perror(err, "error: failed to disconnect");
+			result = -1;
+		}
+	}
+
+	/* Closed only now, the device flushes it on disconnect. */
+	if (trace && fclose(trace)) {
+		perror("error: failed to close trace file");
+		result = -1;
+	}
+
+	if (output_file && output_file != stdout && fclose(output_file)) {
+		perror("failed to close output file");
+		result = -1;
+	}
+	return result;
+}
+
+/* Highest suffix numbering downloads of a port within one second. */
+#define DAEMON_MAX_NAME_SUFFIX 99
+
+/* Downloads a device which has just been plugged in to a directory
+ * of its own, named after the USB port and the time, and converts
+ * and deletes the notes if asked. Reports to standard output. */
+static int daemon_download(struct m210_dev_node const *node_ptr,
+			   struct convert_opts const *convert_opts,
+			   int convert, int delete)
+{
+	int result = -1;
+	char const *const port = strrchr(node_ptr->usb_syspath, '/');
+	char name[PATH_MAX];
+	size_t name_len;
+	time_t const now = time(NULL);
+	int cwd_fd = -1;
+	m210_dev dev = NULL;
+	FILE *output_file = NULL;
+	enum m210_err err;
+
+	name_len = snprintf(name, sizeof(name), "m210_%s_",
+			    port ? port + 1 : node_ptr->usb_syspath);
+	if (name_len >= sizeof(name)
+	    || !strftime(name + name_len, sizeof(name) - name_len,
+			 "%Y%m%dT%H%M%S", localtime(&now))) {
+		errno = ENAMETOOLONG;
+		perror("error: failed to name download directory");
+		goto out;
+	}
+
+	printf("%s: device found\n", name);
+	fflush(stdout);
+
+	err = m210_dev_connect_node(&dev, node_ptr);
+	if (err) {
+		m210_err_perror(err, "failed to open device");
+		goto out;
+	}
+
+	cwd_fd = open(".", O_RDONLY | O_DIRECTORY);
+	if (cwd_fd == -1) {
+		perror("error: failed to open the current working directory");
+		goto out;
+	}
+
+	/* The same port twice within a second gets a suffix. */
+	name_len = strlen(name);
+	for (int suffix = 2; mkdir(name, 0777) == -1; ++suffix) {
+		if (errno != EEXIST || suffix > DAEMON_MAX_NAME_SUFFIX
+		    || (size_t) snprintf(name + name_len,
+					 sizeof(name) - name_len, "_%d",
+					 suffix) >= sizeof(name) - name_len) {
+			perror("error: failed to create download directory");
+			goto out;
+		}
+	}
+	if (chdir(name) == -1) {
+		perror("error: failed to create download directory");
+		goto out;
+	}
+
+	output_file = fopen("notes", "wb");
+	if (output_file == NULL) {
+		perror("error: failed to open output file");
+		goto out;
+	}
+
+	if (convert) {
+		if (dump_and_convert(dev, output_file, NULL,
+				     convert_opts) == -1) {
+			goto out;
+		}
+	} else {
+		err = m210_dev_download_notes(dev, output_file);
+		if (err) {
+			m210_err_perror(err, "failed to download notes");
+			goto out;
+		}
+	}
+
+	if (fclose(output_file)) {
+		output_file = NULL;
+		perror("error: failed to close output file");
+		goto out;
+	}
+	output_file = NULL;
+
+	/* Notes are deleted only once they are safely stored. */
+	if (delete) {
+		err = m210_dev_delete_notes(dev);
+		if (err) {
+			m210_err_perror(err, "failed to delete notes");
+			goto out;
+		}
+	}
+
+	result = 0;
+out:
+	if (output_file) {
+		fclose(output_file);
+	}
+
+	if (dev) {
+		err = m210_dev_disconnect(&dev);
+		if (err) {
+			m210_err_perror(err, "error: failed to disconnect");
+			result = -1;
+		}
+	}
+
+	if (cwd_fd != -1) {
+		if (fchdir(cwd_fd) == -1) {
+			perror("error: failed to return to the working "
+			       "directory");
+			result = -1;
+		}
+		close(cwd_fd);
+	}
+
+	printf("%s: %s\n", name, result == 0 ? "done" : "failed");
+	fflush(stdout);
+	return result;
+}
+
+static int daemon_cmd(int argc, char **argv)
+{
+	int result = -1;
+	int convert = 0;
+	int render = 0;
+	int delete = 0;
+	m210_dev_monitor monitor = NULL;
+	struct m210_dev_list list;
+	struct convert_opts convert_opts;
+	enum m210_err err;
+	const struct option opts[] = {
+		{"output-dir", required_argument, NULL, 'd'},
+		{"convert", no_argument, NULL, 'C'},
+		{"simplify", required_argument, NULL, 's'},
+		{"compact", no_argument, NULL, 'c'},
+		{"delete", no_argument, NULL, 'D'},
+		{0, 0, 0, 0}
+	};
+
+	memset(&list, 0, sizeof(list));
+	memset(&convert_opts, 0, sizeof(convert_opts));
+	convert_opts.output_mode = "wx";
+	convert_opts.style = M210_SVG_STYLE_POLYLINE;
+
+	while (1) {
+		int option = getopt_long(argc, argv, "+", opts, NULL);
+
+		if (option == -1) {
+			break;
+		}
+
+		switch (option) {
+		case 'd':
+			if (chdir(optarg)) {
+				perror("error: failed to change the current "
+				       "working directory");
+				goto out;
+			}
+			break;
+		case 'C':
+			convert = 1;
+			break;
+		case 's':
+			if (parse_non_negative_double(optarg, &convert_opts.tolerance)) {
+				fprintf(stderr, "error: invalid tolerance '%s'\n",
+					optarg);
+				print_help_hint();
+				goto out;
+			}
+			render = 1;
+			break;
+		case 'c':
+			convert_opts.style = M210_SVG_STYLE_PATH;
+			render = 1;
+			break;
+		case 'D':
+			delete = 1;
+			break;
+		default:
+			print_help_hint();
+			goto out;
+		}
+	}
+
+	if (optind != argc) {
+		fprintf(stderr, "error: unexpected daemon arguments\n");
+		print_help_hint();
+		goto out;
+	}
+
+	if (render && !convert) {
+		fprintf(stderr, "error: --simplify and --compact need "
+			"--convert\n");
+		print_help_hint();
+		goto out;
+	}
+
+	/* Monitor first, so that no device slips in between. */
+	err = m210_dev_monitor_new(&monitor);
+	if (err) {
+		m210_err_perror(err, "failed to monitor devices");
+		goto out;
+	}
+
+	err = m210_dev_list_find(&list);
+	if (err) {
+		m210_err_perror(err, "failed to find devices");
+		goto out;
+	}
+
+	/* Devices plugged in since the monitor was created are both
+	 * found and still to be received from the monitor. */
+	for (size_t i = 0; i < list.count; ++i) {
+		err = m210_dev_monitor_ignore(monitor, &list.nodes[i]);
+		if (err) {
+			m210_err_perror(err, "failed to monitor devices");
+			goto out;
+		}
+	}
+
+	/* A failed download does not stop the daemon. */
+	for (size_t i = 0; i < list.count; ++i) {
+		daemon_download(&list.nodes[i], &convert_opts, convert,
+				delete);
+	}
+
+	while (1) {
+		struct m210_dev_node node;
+
+		err = m210_dev_monitor_receive(monitor, &node);
+		if (err) {
+			m210_err_perror(err, "failed to monitor devices");
+			goto out;
+		}
+		daemon_download(&node, &convert_opts, convert, delete);
+	}
+out:
+	m210_dev_list_free(&list);
+	m210_dev_monitor_free(&monitor);
+	return result;
+}
+
+static int capture_cmd(int argc, char **argv)
+{
+	int result = -1;
+	m210_dev dev = NULL;
+	m210_ring ring = NULL;
+	FILE *output_file = NULL;
+	long count = -1;
+	struct m210_dev_info info;
+	int is_mode_switched = 0;
+	struct timespec start;
+	enum m210_err err;
+	const struct option opts[] = {
+		{"output-file", required_argument, NULL, 'o'},
+		{"count", required_argument, NULL, 'n'},
+		{0, 0, 0, 0}
+	};
+
+	output_file = stdout;
+
+	while (1) {
+		int option = getopt_long(argc, argv, "+", opts, NULL);
+
+		if (option == -1) {
+			break;
+		}
+
+		switch (option) {
+		case 'o':
+			output_file = fopen(optarg, "w");
+			if (output_file == NULL) {
+				perror("error: failed to open output file");
+				goto out;
+			}
+			break;
+		case 'n':
+			if (parse_positive_long(optarg, &count)) {
+				fprintf(stderr, "error: invalid count '%s'\n",
+					optarg);
+				print_help_hint();
+				goto out;
+			}
+			break;
+		default:
+			print_help_hint();
+			goto out;
+		}
+	}
 
-	if (asprintf(&filename, "m210_note_%d.svg", note_number) == -1) {
-		/* On error, asprintf() leaves the contents of
-		 * filename undefined. It needs to be NULLed to safely
-		 * call free(). */
-		filename = NULL;
+	if (optind != argc) {
+		fprintf(stderr, "error: unexpected capture arguments\n");
+		print_help_hint();
 		goto out;
 	}
 
-	file = fopen(filename, output_mode);
-out:
-	free(filename);
-	return file;
-}
+	err = m210_dev_connect(&dev);
+	if (err) {
+		m210_err_perror(err, "failed to open device");
+		goto out;
+	}
 
-static int note_to_svg(FILE *input_file, char *output_mode) {
-	int result = -1;
-	FILE *output_file = NULL;
-	struct m210_note_head head;
-	enum m210_err err;
-	int bodyi;
-	int has_path = 0;
+	/* The mode the device was in is restored when done. */
+	err = m210_dev_get_info(dev, &info);
+	if (err) {
+		m210_err_perror(err, "failed to read device mode");
+		goto out;
+	}
 
-	err = m210_note_read_head(&head, input_file);
+	err = m210_dev_set_mode(dev, M210_DEV_MODE_TABLET);
 	if (err) {
-		m210_err_perror(err, "error: failed to read note head");
+		m210_err_perror(err, "failed to switch to tablet mode");
 		goto out;
 	}
+	is_mode_switched = info.mode != M210_DEV_MODE_TABLET;
 
-	if (head.number == 0) {
-		/* End of note stream. */
-		result = 0;
+	/* Samples are read in a thread of their own, writing the
+	 * output does not hold back reading the device. */
+	err = m210_ring_new(&ring, sizeof(struct m210_dev_sample),
+			    CAPTURE_RING_CAPACITY);
+	if (err) {
+		m210_err_perror(err, "failed to allocate sample buffer");
 		goto out;
 	}
 
-	output_file = open_svg_file(head.number, output_mode);
-	if (output_file == NULL) {
-		perror("error: failed to create SVG file");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	err = m210_dev_start_reader(dev, ring);
+	if (err) {
+		m210_err_perror(err, "failed to start reading pen");
 		goto out;
 	}
 
-	fprintf(output_file, "%s\n", "<?xml version=\"1.0\"?>");
-	fprintf(output_file, "%s\n", "<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" \"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">");
-	fprintf(output_file, "%s\n", "<svg width=\"210mm\" height=\"297mm\" viewBox=\"-7000 0 14000 20000\" xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\">");
+	for (long i = 0; count < 0 || i < count; ++i) {
+		struct m210_dev_sample sample;
+		struct timespec time;
 
-	for (bodyi = 0; bodyi < head.bodyc; ++bodyi) {
-		struct m210_note_body body;
-		err = m210_note_read_body(&body, input_file);
+		err = m210_ring_wait(ring, &sample, -1);
 		if (err) {
-			m210_err_perror(err, "error: failed to read note body");
+			m210_err_perror(err, "failed to read pen");
 			goto out;
 		}
-		if (body.pressure) {
-			if (!has_path) {
-				fprintf(output_file,
-					"<polyline stroke-width=\"%d\" "
-					"stroke=\"%s\" fill=\"none\" points=\"",
-					svg_stroke_width, svg_stroke_color);
-				has_path = 1;
-			}
-			fprintf(output_file, "%d,%d ", body.x, body.y);
-		} else {
-			fprintf(output_file, "%s\n", "\" />");
-			has_path = 0;
+
+		time.tv_sec = sample.time.tv_sec - start.tv_sec;
+		time.tv_nsec = sample.time.tv_nsec - start.tv_nsec;
+		if (time.tv_nsec < 0) {
+			time.tv_nsec += 1000000000;
+			--time.tv_sec;
 		}
-	}
 
-	if (fprintf(output_file, "%s", "</svg>\n") < 0) {
-		perror("error: failed to write to output file");
-		goto out;
+		/* Every sample is passed on at once, a reader of the
+		 * output sees the pen live. */
+		if (fprintf(output_file, "%ld.%06ld\t%u\t%u\t%u\t%c%c%c%c\n",
+			    (long) time.tv_sec, time.tv_nsec / 1000,
+			    sample.x, sample.y, sample.pressure,
+			    sample.state & M210_DEV_SAMPLE_IN_RANGE ? 'r' : '-',
+			    sample.state & M210_DEV_SAMPLE_TIP ? 't' : '-',
+			    sample.state & M210_DEV_SAMPLE_SW1 ? '1' : '-',
+			    sample.state & M210_DEV_SAMPLE_SW2 ? '2' : '-') < 0
+		    || fflush(output_file)) {
+			perror("error: failed to write to output file");
+			goto out;
+		}
 	}
 
-	result = 1;
+	result = 0;
 out:
+	if (is_mode_switched) {
+		err = m210_dev_stop_reader(dev);
+		if (!err) {
+			err = m210_dev_set_mode(dev, info.mode);
+		}
+		if (err) {
+			m210_err_perror(err, "failed to restore device mode");
+			result = -1;
+		}
+	}
+
+	if (dev) {
+		err = m210_dev_disconnect(&dev);
+		if (err) {
+			m210_err_perror(err, "error: failed to disconnect");
+			result = -1;
+		}
+	}
+
+	if (ring) {
+		struct m210_ring_counters counters;
+
+		m210_ring_get_counters(ring, &counters);
+		if (counters.overflows) {
+			fprintf(stderr, "warning: %llu samples were dropped, "
+				"output was not written fast enough\n",
+				(unsigned long long) counters.overflows);
+		}
+		m210_ring_free(&ring);
+	}
+
 	if (output_file && output_file != stdout && fclose(output_file)) {
-		perror("error: failed to close output file");
+		perror("failed to close output file");
 		result = -1;
 	}
 	return result;
 }
 
-static int convert_cmd(int argc, char **argv)
+/* Latencies from reading a report to writing its events, bucket i
+ * counts those shorter than 2^i microseconds but not shorter than
+ * 2^(i - 1), the last one counts everything longer. */
+#define UINPUT_LATENCY_BUCKETS 21
+
+struct uinput_latency {
+	unsigned long counts[UINPUT_LATENCY_BUCKETS];
+	unsigned long total;
+	unsigned long below_ms;
+	long max_us;
+	double sum_us;
+};
+
+static volatile sig_atomic_t uinput_stop;
+
+static void uinput_handle_signal(int const signum)
+{
+	(void) signum;
+	uinput_stop = 1;
+}
+
+static void uinput_latency_add(struct uinput_latency *const latency,
+			       struct timespec const *const from,
+			       struct timespec const *const to)
+{
+	long const us = ((to->tv_sec - from->tv_sec) * 1000000L
+			 + (to->tv_nsec - from->tv_nsec) / 1000);
+	int bucket = 0;
+
+	while (bucket < UINPUT_LATENCY_BUCKETS - 1 && us >= (1L << bucket)) {
+		++bucket;
+	}
+	++latency->counts[bucket];
+	++latency->total;
+	if (us < 1000) {
+		++latency->below_ms;
+	}
+	latency->sum_us += us;
+	if (us > latency->max_us) {
+		latency->max_us = us;
+	}
+}
+
+static void uinput_latency_print(struct uinput_latency const *const latency)
+{
+	if (latency->total == 0) {
+		return;
+	}
+
+	fprintf(stderr, "Latency from report to events, %lu reports:\n",
+		latency->total);
+	for (int i = 0; i < UINPUT_LATENCY_BUCKETS; ++i) {
+		if (latency->counts[i] == 0) {
+			continue;
+		}
+		if (i == UINPUT_LATENCY_BUCKETS - 1) {
+			fprintf(stderr, "  >= %7ld us: %lu\n",
+				1L << (i - 1), latency->counts[i]);
+		} else {
+			fprintf(stderr, "  <  %7ld us: %lu\n",
+				1L << i, latency->counts[i]);
+		}
+	}
+	fprintf(stderr, "  mean %.1f us, max %ld us, %.2f%% under 1 ms\n",
+		latency->sum_us / latency->total, latency->max_us,
+		100.0 * latency->below_ms / latency->total);
+}
+
+static int parse_axis_max(char const *const str, uint16_t *const value_ptr)
+{
+	long value;
+
+	if (parse_positive_long(str, &value) || value > UINT16_MAX) {
+		return -1;
+	}
+	*value_ptr = value;
+	return 0;
+}
+
+static int uinput_cmd(int argc, char **argv)
 {
 	int result = -1;
-	FILE *input_file = NULL;
-	char *output_mode = "wx";
+	m210_dev dev = NULL;
+	m210_uinput uinput = NULL;
+	struct m210_uinput_ranges ranges;
+	struct uinput_latency latency;
+	struct sigaction action;
+	long count = -1;
+	struct m210_dev_info info;
+	int is_mode_switched = 0;
+	enum m210_err err;
 	const struct option opts[] = {
-		{"input-file", required_argument, NULL, 'i'},
-		{"output-dir", required_argument, NULL, 'd'},
-		{"overwrite", no_argument, NULL, 'f'},
+		{"max-x", required_argument, NULL, 'x'},
+		{"max-y", required_argument, NULL, 'y'},
+		{"max-pressure", required_argument, NULL, 'p'},
+		{"count", required_argument, NULL, 'n'},
 		{0, 0, 0, 0}
 	};
 
-	input_file = stdin;
+	ranges.max_x = M210_UINPUT_DEFAULT_MAX_X;
+	ranges.max_y = M210_UINPUT_DEFAULT_MAX_Y;
+	ranges.max_pressure = M210_UINPUT_DEFAULT_MAX_PRESSURE;
+	memset(&latency, 0, sizeof(struct uinput_latency));
 
 	while (1) {
 		int option = getopt_long(argc, argv, "+", opts, NULL);
+		uint16_t *max_ptr = NULL;
 
 		if (option == -1) {
 			break;
 		}
 
 		switch (option) {
-		case 'i':
-			input_file = fopen(optarg, "rb");
-			if (input_file == NULL) {
-				perror("error: failed to open input file");
-				goto out;
-			}
+		case 'x':
+			max_ptr = &ranges.max_x;
 			break;
-		case 'd':
-			if (chdir(optarg)) {
-				perror("error: failed to change the current "
-				       "working directory");
+		case 'y':
+			max_ptr = &ranges.max_y;
+			break;
+		case 'p':
+			max_ptr = &ranges.max_pressure;
+			break;
+		case 'n':
+			if (parse_positive_long(optarg, &count)) {
+				fprintf(stderr, "error: invalid count '%s'\n",
+					optarg);
+				print_help_hint();
 				goto out;
 			}
 			break;
-		case 'f':
-			output_mode = "w";
-			break;
 		default:
 			print_help_hint();
 			goto out;
 		}
+
+		if (max_ptr && parse_axis_max(optarg, max_ptr)) {
+			fprintf(stderr, "error: invalid maximum '%s'\n",
+				optarg);
+			print_help_hint();
+			goto out;
+		}
 	}
 
 	if (optind != argc) {
-		fprintf(stderr, "error: unexpected convert arguments\n");
+		fprintf(stderr, "error: unexpected uinput arguments\n");
 		print_help_hint();
 		goto out;
 	}
 
-	while (1) {
-		result = note_to_svg(input_file, output_mode);
-		if (result == -1) {
+	err = m210_dev_connect(&dev);
+	if (err) {
+		m210_err_perror(err, "failed to open device");
+		goto out;
+	}
+
+	err = m210_uinput_new(&uinput, &ranges);
+	if (err) {
+		m210_err_perror(err, "failed to create input device");
+		goto out;
+	}
+
+	/* The mode the device was in is restored when done. */
+	err = m210_dev_get_info(dev, &info);
+	if (err) {
+		m210_err_perror(err, "failed to read device mode");
+		goto out;
+	}
+
+	err = m210_dev_set_mode(dev, M210_DEV_MODE_TABLET);
+	if (err) {
+		m210_err_perror(err, "failed to switch to tablet mode");
+		goto out;
+	}
+	is_mode_switched = info.mode != M210_DEV_MODE_TABLET;
+
+	/* Interrupting stops injecting, the latencies are printed
+	 * and the input device is removed. */
+	memset(&action, 0, sizeof(struct sigaction));
+	action.sa_handler = uinput_handle_signal;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGINT, &action, NULL) == -1
+	    || sigaction(SIGTERM, &action, NULL) == -1) {
+		perror("error: failed to set signal handler");
+		goto out;
+	}
+
+	/* Reports are injected from the thread reading them: handing
+	 * them over to another one would only add to the latency. */
+	for (long i = 0; !uinput_stop && (count < 0 || i < count);) {
+		struct m210_dev_sample sample;
+		struct timespec written;
+
+		err = m210_dev_read_sample(dev, &sample,
+					   UINPUT_STOP_INTERVAL);
+		if (err == M210_ERR_DEV_TIMEOUT) {
+			continue;
+		}
+		if (err) {
+			m210_err_perror(err, "failed to read pen");
+			goto out;
+		}
+
+		err = m210_uinput_write_sample(uinput, &sample);
+		if (err) {
+			m210_err_perror(err, "failed to inject pen events");
 			goto out;
-		} else if (result == 0) {
-			break;
 		}
+		clock_gettime(CLOCK_MONOTONIC, &written);
+		uinput_latency_add(&latency, &sample.time, &written);
+		++i;
 	}
 
+	result = 0;
 out:
-	if (input_file && input_file != stdin && fclose(input_file)) {
-		perror("failed to close input file");
-		result = -1;
+	uinput_latency_print(&latency);
+
+	if (uinput) {
+		err = m210_uinput_free(&uinput);
+		if (err) {
+			m210_err_perror(err, "failed to remove input device");
+			result = -1;
+		}
+	}
+
+	if (is_mode_switched) {
+		err = m210_dev_set_mode(dev, info.mode);
+		if (err) {
+			m210_err_perror(err, "failed to restore device mode");
+			result = -1;
+		}
+	}
+
+	if (dev) {
+		err = m210_dev_disconnect(&dev);
+		if (err) {
+			m210_err_perror(err, "error: failed to disconnect");
+			result = -1;
+		}
 	}
 	return result;
 }
 
-static int delete_cmd(int argc, char **argv)
+static int replay_cmd(int argc, char **argv)
 {
 	int result = -1;
-	m210_dev dev;
+	m210_dev dev = NULL;
+	FILE *input_file = NULL;
+	FILE *output_file = NULL;
+	double speed = 1;
+	struct m210_dev_transport transport;
+	struct m210_trace_counters counters;
+	struct timespec start;
+	struct timespec end;
 	enum m210_err err;
 	const struct option opts[] = {
+		{"input-file", required_argument, NULL, 'i'},
+		{"output-file", required_argument, NULL, 'o'},
+		{"speed", required_argument, NULL, 's'},
 		{0, 0, 0, 0}
 	};
 
+	input_file = stdin;
+	output_file = stdout;
+
 	while (1) {
 		int option = getopt_long(argc, argv, "+", opts, NULL);
 
@@ -268,6 +2853,28 @@ static int delete_cmd(int argc, char **argv)
 		}
 
 		switch (option) {
+		case 'i':
+			input_file = fopen(optarg, "rb");
+			if (input_file == NULL) {
+				perror("error: failed to open input file");
+				goto out;
+			}
+			break;
+		case 'o':
+			output_file = fopen(optarg, "wb");
+			if (output_file == NULL) {
+				perror("error: failed to open output file");
+				goto out;
+			}
+			break;
+		case 's':
+			if (parse_non_negative_double(optarg, &speed)) {
+				fprintf(stderr, "error: invalid speed '%s'\n",
+					optarg);
+				print_help_hint();
+				goto out;
+			}
+			break;
 		default:
 			print_help_hint();
 			goto out;
@@ -275,22 +2882,40 @@ static int delete_cmd(int argc, char **argv)
 	}
 
 	if (optind != argc) {
-		fprintf(stderr, "error: unexpected delete arguments\n");
+		fprintf(stderr, "error: unexpected replay arguments\n");
 		print_help_hint();
 		goto out;
 	}
 
-	err = m210_dev_connect(&dev);
+	err = m210_trace_replay(&transport, input_file, speed);
 	if (err) {
-		m210_err_perror(err, "failed to open device");
+		m210_err_perror(err, "failed to read trace");
 		goto out;
 	}
 
-	err = m210_dev_delete_notes(dev);
+	err = m210_dev_connect_transport(&dev, &transport);
+	if (err) {
+		m210_err_perror(err, "failed to replay trace");
+		goto out;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	err = m210_dev_download_notes(dev, output_file);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (err) {
+		m210_err_perror(err, "failed to download notes");
+	}
+
+	/* Also tells how far a diverging replay got. */
+	m210_trace_get_counters(&transport, &counters);
+	fprintf(stderr, "Replayed %lu requests, %lu reports and %lu timeouts "
+		"in %.3f seconds.\n",
+		counters.requests, counters.reports, counters.timeouts,
+		(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
 	if (err) {
-		m210_err_perror(err, "failed to delete notes");
 		goto out;
 	}
+
 	result = 0;
 out:
 	if (dev) {
@@ -300,20 +2925,40 @@ out:
 			result = -1;
 		}
 	}
+
+	if (input_file && input_file != stdin) {
+		fclose(input_file);
+	}
+
+	if (output_file && output_file != stdout && fclose(output_file)) {
+		perror("failed to close output file");
+		result = -1;
+	}
 	return result;
 }
 
-static int dump_cmd(int argc, char **argv)
+/* Writes a raw dump as an archive, or with --extract an archive back
+ * as the raw dump it was written from. Either kind of input is
+ * accepted both ways, the note map decodes archives. */
+static int archive_cmd(int argc, char **argv)
 {
 	int result = -1;
-	m210_dev dev;
+	int extract = 0;
+	FILE *input_file = NULL;
 	FILE *output_file = NULL;
+	m210_note_map map = NULL;
+	struct stat input_stat;
+	uint8_t const *dump;
+	size_t dump_size;
 	enum m210_err err;
 	const struct option opts[] = {
+		{"input-file", required_argument, NULL, 'i'},
 		{"output-file", required_argument, NULL, 'o'},
+		{"extract", no_argument, NULL, 'x'},
 		{0, 0, 0, 0}
 	};
 
+	input_file = stdin;
 	output_file = stdout;
 
 	while (1) {
@@ -324,6 +2969,13 @@ static int dump_cmd(int argc, char **argv)
 		}
 
 		switch (option) {
+		case 'i':
+			input_file = fopen(optarg, "rb");
+			if (input_file == NULL) {
+				perror("error: failed to open input file");
+				goto out;
+			}
+			break;
 		case 'o':
 			output_file = fopen(optarg, "wb");
 			if (output_file == NULL) {
@@ -331,6 +2983,9 @@ static int dump_cmd(int argc, char **argv)
 				goto out;
 			}
 			break;
+		case 'x':
+			extract = 1;
+			break;
 		default:
 			print_help_hint();
 			goto out;
@@ -338,35 +2993,50 @@ static int dump_cmd(int argc, char **argv)
 	}
 
 	if (optind != argc) {
-		fprintf(stderr, "error: unexpected dump arguments\n");
+		fprintf(stderr, "error: unexpected archive arguments\n");
 		print_help_hint();
 		goto out;
 	}
 
-	err = m210_dev_connect(&dev);
-	if (err) {
-		m210_err_perror(err, "failed to open device");
+	if (fstat(fileno(input_file), &input_stat) == -1) {
+		perror("error: failed to stat input file");
 		goto out;
 	}
 
-	err = m210_dev_download_notes(dev, output_file);
+	if (S_ISREG(input_stat.st_mode)) {
+		err = m210_note_map_open(&map, fileno(input_file));
+	} else {
+		err = m210_note_map_open_stream(&map, input_file);
+	}
 	if (err) {
-		m210_err_perror(err, "failed to download notes");
+		m210_err_perror(err, "error: failed to read input file");
 		goto out;
 	}
 
-	result = 0;
-out:
-	if (dev) {
-		err = m210_dev_disconnect(&dev);
+	dump = m210_note_map_get_data(map, &dump_size);
+	if (extract) {
+		if (dump_size && fwrite(dump, dump_size, 1, output_file) != 1) {
+			perror("error: failed to write dump");
+			goto out;
+		}
+	} else {
+		err = m210_archive_write(output_file, dump, dump_size);
 		if (err) {
-			m210_err_perror(err, "error: failed to disconnect");
-			result = -1;
+			m210_err_perror(err, "error: failed to write archive");
+			goto out;
 		}
 	}
 
+	result = 0;
+out:
+	m210_note_map_close(&map);
+
+	if (input_file && input_file != stdin) {
+		fclose(input_file);
+	}
+
 	if (output_file && output_file != stdout && fclose(output_file)) {
-		perror("failed to close output file");
+		perror("error: failed to close output file");
 		result = -1;
 	}
 	return result;
@@ -375,11 +3045,13 @@ out:
 static int info_cmd(int argc, char **argv)
 {
 	int result = -1;
-	m210_dev dev;
+	m210_dev dev = NULL;
 	enum m210_err err;
 	struct m210_dev_info info;
 	const char *device_mode;
+	enum stats_format stats_format = STATS_NONE;
 	const struct option opts[] = {
+		{"stats", optional_argument, NULL, 'S'},
 		{0, 0, 0, 0}
 	};
 
@@ -391,6 +3063,14 @@ static int info_cmd(int argc, char **argv)
 		}
 
 		switch (option) {
+		case 'S':
+			if (parse_stats_format(optarg, &stats_format)) {
+				fprintf(stderr, "error: invalid stats format "
+					"'%s'\n", optarg);
+				print_help_hint();
+				goto out;
+			}
+			break;
 		default:
 			print_help_hint();
 			goto out;
@@ -435,6 +3115,10 @@ static int info_cmd(int argc, char **argv)
 
 	result = 0;
 out:
+	if (dev && stats_format != STATS_NONE) {
+		print_stats(dev, stats_format);
+	}
+
 	if (dev) {
 		err = m210_dev_disconnect(&dev);
 		if (err) {
@@ -496,8 +3180,20 @@ int main(int argc, char **argv)
 		cmdfn = &dump_cmd;
 	} else if (strcmp(cmd, "convert") == 0) {
 		cmdfn = &convert_cmd;
+	} else if (strcmp(cmd, "list") == 0) {
+		cmdfn = &list_cmd;
 	} else if (strcmp(cmd, "delete") == 0) {
 		cmdfn = &delete_cmd;
+	} else if (strcmp(cmd, "daemon") == 0) {
+		cmdfn = &daemon_cmd;
+	} else if (strcmp(cmd, "capture") == 0) {
+		cmdfn = &capture_cmd;
+	} else if (strcmp(cmd, "uinput") == 0) {
+		cmdfn = &uinput_cmd;
+	} else if (strcmp(cmd, "replay") == 0) {
+		cmdfn = &replay_cmd;
+	} else if (strcmp(cmd, "archive") == 0) {
+		cmdfn = &archive_cmd;
 	} else {
 		fprintf(stderr, "error: unknown command '%s'\n", cmd);
 		print_help_hint();